@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "accel.h"
+
+/**
+ * Cycle level model of an accelerator built from several FCU trios
+ *
+ * Every output row of every (filter, input channel) pair is split into
+ * ceil(K / 3)^2 trio tasks, each one output row long: one trio covers three
+ * kernel rows by three taps, and runs one cycle per output column. Tasks are
+ * handed to the first free trio once their inputs, weights and output buffer
+ * row are available. Inputs, weights and finished output rows move over one
+ * DRAM channel that serves transfers in the order the controller issues them,
+ * each taking bytes / bandwidth cycles on the channel plus a fixed latency
+ *
+ * Input buffer: when it can hold K + S rows of every channel it works as a
+ * line buffer, each output row only loads the S new rows per channel and as
+ * many following output rows as the spare rows allow are prefetched while the
+ * current ones are in use. Otherwise the
+ * channels are streamed in chunks, K rows per channel for every output row,
+ * double buffered when two chunks fit.
+ *
+ * Output buffer: holds one row of partial sums per filter of the current
+ * pass. Filters that do not fit are done in further passes over the same
+ * output row, which re-stream the inputs when they are not resident. Spare
+ * rows let a filter start its next row while the last one is written back.
+ *
+ * Weight buffer: when every weight fits they are loaded once up front,
+ * otherwise each chunk reloads the weights it uses. Chunks and, if need be,
+ * the filters of a pass then shrink until the weights of one chunk fit
+ */
+
+typedef struct {
+    const accel_config_s* config;
+    accel_report_s* report;
+    long channel_free;              //first cycle the DRAM channel is idle
+    long* trio_free;                //first cycle each trio is idle
+} accel_sim_s;
+
+//queue a read, returns the cycle its data is usable
+static long dram_transfer(accel_sim_s* sim, long issue, long bytes) {
+    if (bytes <= 0) return issue;
+    long start = issue > sim->channel_free ? issue : sim->channel_free;
+    long duration = (long)(bytes / sim->config->dram_bytes_per_cycle);
+    if (duration * sim->config->dram_bytes_per_cycle < bytes) duration++;
+    sim->channel_free = start + duration;
+    return sim->channel_free + sim->config->dram_latency;
+}
+
+//queue a write, returns the cycle the data has left the buffer
+static long dram_write(accel_sim_s* sim, long issue, long bytes) {
+    dram_transfer(sim, issue, bytes);
+    return sim->channel_free;
+}
+
+static int earliest_trio(accel_sim_s* sim) {
+    int best = 0;
+    for (int p = 1; p < sim->config->n_trios; p++) {
+        if (sim->trio_free[p] < sim->trio_free[best]) best = p;
+    }
+    return best;
+}
+
+/**
+ * Check that the accelerator can run the layer at all
+ *
+ * @return NULL if it can, otherwise why not
+ */
+const char* accel_config_error(const accel_config_s* config, const accel_layer_s* layer) {
+    if (config->n_trios < 1) return "at least one FCU trio is needed";
+    if (config->dram_bytes_per_cycle <= 0) return "DRAM bandwidth must be positive";
+    if (config->element_bytes < 1) return "element size must be positive";
+    if (layer->kernel_size < 1 || layer->stride < 1 || layer->size < layer->kernel_size) {
+        return "the kernel does not fit the image";
+    }
+    if (layer->groups < 1 || layer->channels % layer->groups != 0 || layer->filters % layer->groups != 0) {
+        return "groups must divide both channels and filters";
+    }
+
+    long row_bytes = (long)layer->size * config->element_bytes;
+    if (config->input_buffer_bytes < layer->kernel_size * row_bytes) {
+        return "the input buffer cannot hold kernel_size rows of one channel";
+    }
+    int out = (layer->size - layer->kernel_size) / layer->stride + 1;
+    if (config->output_buffer_bytes < (long)out * config->element_bytes) {
+        return "the output buffer cannot hold one output row";
+    }
+    long kernel_bytes = (long)layer->kernel_size * layer->kernel_size * config->element_bytes;
+    if (config->weight_buffer_bytes < kernel_bytes) {
+        return "the weight buffer cannot hold one kernel";
+    }
+    return NULL;
+}
+
+/**
+ * Run the model for one layer
+ *
+ * The configuration must have passed accel_config_error()
+ *
+ * @param config Accelerator to model
+ * @param layer Layer to run on it
+ * @param report Filled with cycle counts, stalls and traffic
+ */
+void simulate_accelerator(const accel_config_s* config, const accel_layer_s* layer, accel_report_s* report) {
+    memset(report, 0, sizeof(accel_report_s));
+
+    int k = layer->kernel_size;
+    int s = layer->stride;
+    int out = (layer->size - k) / s + 1;
+    int eb = config->element_bytes;
+    int per_group = layer->channels / layer->groups;
+    int filters_per_group = layer->filters / layer->groups;
+    int tasks_per_pair = ((k + 2) / 3) * ((k + 2) / 3);
+    long row_bytes = (long)layer->size * eb;
+    long kernel_bytes = (long)k * k * eb;
+
+    //input buffer as line buffers with prefetch, or streamed chunks
+    long buffer_rows = config->input_buffer_bytes / row_bytes;
+    int line_buffered = buffer_rows >= (long)layer->channels * (k + s);
+    long prefetch_rows = line_buffered ? (buffer_rows / layer->channels - k) / s : 0;
+    int chunk = layer->channels;
+    int double_buffered = 1;
+    if (!line_buffered) {
+        chunk = (int)(buffer_rows / (2 * k));
+        if (chunk < 1) {
+            chunk = (int)(buffer_rows / k);
+            double_buffered = 0;
+        }
+        if (chunk > layer->channels) chunk = layer->channels;
+    }
+
+    long pairs = (long)layer->filters * per_group;
+    int weights_resident = config->weight_buffer_bytes >= pairs * kernel_bytes;
+
+    int output_rows = (int)(config->output_buffer_bytes / ((long)out * eb));
+    int pass_filters = output_rows < layer->filters ? output_rows : layer->filters;
+
+    //reloaded weights of one chunk, pass_filters x chunk kernels at most, have to fit the buffer
+    if (!weights_resident) {
+        long buffer_kernels = config->weight_buffer_bytes / kernel_bytes;
+        if (pass_filters > buffer_kernels) pass_filters = (int)buffer_kernels;
+        if (chunk > buffer_kernels / pass_filters) chunk = (int)(buffer_kernels / pass_filters);
+    }
+    int slots_per_filter = output_rows / pass_filters;
+    int passes = (layer->filters + pass_filters - 1) / pass_filters;
+
+    report->channels_resident = chunk;
+    report->output_pass_filters = pass_filters;
+    report->weights_resident = weights_resident;
+
+    accel_sim_s sim;
+    sim.config = config;
+    sim.report = report;
+    sim.channel_free = 0;
+    sim.trio_free = (long*)calloc(config->n_trios, sizeof(long));
+    long* slot_ready = (long*)calloc((long)pass_filters * slots_per_filter, sizeof(long));
+    long* filter_done = (long*)calloc(layer->filters, sizeof(long));
+    long* row_done = (long*)calloc(out, sizeof(long));
+    long* row_ready = (long*)calloc(out, sizeof(long));
+    if (sim.trio_free == NULL || slot_ready == NULL || filter_done == NULL || row_done == NULL || row_ready == NULL) {
+        fprintf(stderr, "Memory allocation failed for accelerator model\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long weights_ready = 0;
+    if (weights_resident) {
+        weights_ready = dram_transfer(&sim, 0, pairs * kernel_bytes);
+        report->dram_weight_bytes += pairs * kernel_bytes;
+    }
+
+    //compute finish of the last two streamed chunks, their buffers free up then
+    long step_done[2] = {0, 0};
+    long last_write = 0;
+
+    //line buffers start out filling the whole prefetch window
+    for (int r = 0; line_buffered && r <= prefetch_rows && r < out; r++) {
+        long bytes = (long)layer->channels * (r == 0 ? k : s) * row_bytes;
+        row_ready[r] = dram_transfer(&sim, 0, bytes);
+        report->dram_input_bytes += bytes;
+    }
+
+    for (int r = 0; r < out; r++) {
+        for (int f0 = 0; f0 < layer->filters; f0 += pass_filters) {
+            int f1 = f0 + pass_filters < layer->filters ? f0 + pass_filters : layer->filters;
+            int first_channel = (f0 / filters_per_group) * per_group;
+            int last_channel = ((f1 - 1) / filters_per_group + 1) * per_group;
+            //output rows of this pass, each filter cycles through its own slots
+            long* slots = slot_ready + (((long)r * passes + f0 / pass_filters) % slots_per_filter) * pass_filters;
+
+            for (int o = f0; o < f1; o++) filter_done[o] = 0;
+
+            for (int c0 = first_channel; c0 < last_channel; c0 += chunk) {
+                int c1 = c0 + chunk < last_channel ? c0 + chunk : last_channel;
+
+                //inputs for this chunk, line buffered rows were prefetched already
+                long issue = double_buffered ? step_done[1] : step_done[0];
+                long input_bytes = line_buffered ? 0 : (long)(c1 - c0) * k * row_bytes;
+
+                long weight_bytes = 0;
+                if (!weights_resident) {
+                    for (int o = f0; o < f1; o++) {
+                        int g0 = (o / filters_per_group) * per_group;
+                        int lo = c0 > g0 ? c0 : g0;
+                        int hi = c1 < g0 + per_group ? c1 : g0 + per_group;
+                        if (hi > lo) weight_bytes += (hi - lo) * kernel_bytes;
+                    }
+                }
+
+                long ready = dram_transfer(&sim, issue, input_bytes + weight_bytes);
+                if (line_buffered && ready < row_ready[r]) ready = row_ready[r];
+                if (ready < weights_ready) ready = weights_ready;
+                report->dram_input_bytes += input_bytes;
+                report->dram_weight_bytes += weight_bytes;
+
+                //hand the chunk's tasks to the trios
+                long done = 0;
+                for (int o = f0; o < f1; o++) {
+                    int g0 = (o / filters_per_group) * per_group;
+                    int lo = c0 > g0 ? c0 : g0;
+                    int hi = c1 < g0 + per_group ? c1 : g0 + per_group;
+
+                    for (long task = 0; task < (long)(hi - lo) * tasks_per_pair; task++) {
+                        int p = earliest_trio(&sim);
+                        long free_at = sim.trio_free[p];
+                        long gate = ready > slots[o - f0] ? ready : slots[o - f0];
+                        long start = free_at > gate ? free_at : gate;
+
+                        if (start > free_at) {
+                            if (slots[o - f0] > ready) {
+                                report->output_stall_cycles += start - free_at;
+                            } else {
+                                report->input_stall_cycles += start - free_at;
+                            }
+                        }
+
+                        sim.trio_free[p] = start + out;
+                        report->busy_cycles += out;
+                        if (sim.trio_free[p] > filter_done[o]) filter_done[o] = sim.trio_free[p];
+                        if (sim.trio_free[p] > done) done = sim.trio_free[p];
+                        report->weight_buffer_bytes += 9L * eb;
+                    }
+                }
+
+                step_done[1] = step_done[0];
+                step_done[0] = done;
+                if (done > row_done[r]) row_done[r] = done;
+            }
+
+            //write each finished output row back, its buffer row is free once that is done
+            for (int o = f0; o < f1; o++) {
+                slots[o - f0] = dram_write(&sim, filter_done[o], (long)out * eb);
+                if (slots[o - f0] > last_write) last_write = slots[o - f0];
+                report->dram_output_bytes += (long)out * eb;
+            }
+        }
+
+        //the row is done with its oldest input rows, refill them with the next row of the window
+        int next = r + 1 + (int)prefetch_rows;
+        if (line_buffered && next < out) {
+            long bytes = (long)layer->channels * s * row_bytes;
+            row_ready[next] = dram_transfer(&sim, row_done[r], bytes);
+            report->dram_input_bytes += bytes;
+        }
+    }
+
+    report->cycles = last_write;
+    for (int p = 0; p < config->n_trios; p++) {
+        if (sim.trio_free[p] > report->cycles) report->cycles = sim.trio_free[p];
+    }
+
+    long trio_cycles = report->cycles * config->n_trios;
+    report->idle_cycles = trio_cycles - report->busy_cycles - report->input_stall_cycles - report->output_stall_cycles;
+    report->outputs = (long)layer->filters * out * out;
+    report->macs = report->outputs * k * k * per_group;
+    report->utilization = trio_cycles > 0 ? (double)report->busy_cycles / trio_cycles : 0.0;
+    report->macs_per_cycle = report->cycles > 0 ? (double)report->macs / report->cycles : 0.0;
+
+    //each trio cycle reads 3 pixels per FCU and updates y_0, y_1 and y_2
+    report->input_buffer_bytes = report->dram_input_bytes + report->busy_cycles * 9 * eb;
+    report->weight_buffer_bytes += report->dram_weight_bytes;
+    report->output_buffer_bytes = report->busy_cycles * 6 * eb + report->dram_output_bytes;
+
+    free(sim.trio_free);
+    free(slot_ready);
+    free(filter_done);
+    free(row_done);
+    free(row_ready);
+}
+
+void print_accel_report(const accel_config_s* config, const accel_layer_s* layer, const accel_report_s* report) {
+    long trio_cycles = report->cycles * config->n_trios;
+
+    printf("\n************* Accelerator **************\n");
+    printf("FCU trios: %d\n", config->n_trios);
+    printf("Buffers: input %ld B, weight %ld B, output %ld B\n", config->input_buffer_bytes,
+           config->weight_buffer_bytes, config->output_buffer_bytes);
+    printf("DRAM: %.2f B/cycle, %d cycles latency\n", config->dram_bytes_per_cycle, config->dram_latency);
+    printf("Layer: %dx%d, %d channels, %d filters, %d groups, %dx%d kernel, stride %d\n", layer->size, layer->size,
+           layer->channels, layer->filters, layer->groups, layer->kernel_size, layer->kernel_size, layer->stride);
+    printf("Input buffer: %s, %d channels at a time\n",
+           report->channels_resident == layer->channels ? "resident" : "streamed", report->channels_resident);
+    printf("Output passes per row: %d\n",
+           (layer->filters + report->output_pass_filters - 1) / report->output_pass_filters);
+    printf("Weights: %s\n", report->weights_resident ? "loaded once" : "reloaded per chunk");
+    printf("----------------------------------------\n");
+    printf("Cycles: %ld (%.3f ms at %.0f MHz)\n", report->cycles,
+           report->cycles / (config->clock_mhz * 1e3), config->clock_mhz);
+    printf("Throughput: %.2f MACs/cycle, %.3f outputs/cycle\n", report->macs_per_cycle,
+           report->cycles > 0 ? (double)report->outputs / report->cycles : 0.0);
+    printf("Utilization: %.1f%%\n", 100.0 * report->utilization);
+    printf("Stalls: input %ld (%.1f%%), output %ld (%.1f%%), idle %ld (%.1f%%) trio cycles\n",
+           report->input_stall_cycles, trio_cycles > 0 ? 100.0 * report->input_stall_cycles / trio_cycles : 0.0,
+           report->output_stall_cycles, trio_cycles > 0 ? 100.0 * report->output_stall_cycles / trio_cycles : 0.0,
+           report->idle_cycles, trio_cycles > 0 ? 100.0 * report->idle_cycles / trio_cycles : 0.0);
+    printf("DRAM traffic: input %ld B, weight %ld B, output %ld B\n",
+           report->dram_input_bytes, report->dram_weight_bytes, report->dram_output_bytes);
+    printf("Buffer traffic: input %ld B, weight %ld B, output %ld B\n",
+           report->input_buffer_bytes, report->weight_buffer_bytes, report->output_buffer_bytes);
+    printf("****************************************\n");
+}
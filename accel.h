@@ -0,0 +1,58 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+/**
+ * Configuration of the modelled accelerator
+ *
+ * n_trios FCU trios share one input, one weight and one output buffer, fed
+ * from DRAM over a single channel
+ */
+typedef struct {
+    int n_trios;
+    long input_buffer_bytes;
+    long weight_buffer_bytes;
+    long output_buffer_bytes;
+    double dram_bytes_per_cycle;
+    int dram_latency;               //cycles from the end of a transfer to the data being usable
+    int element_bytes;              //size of one pixel, weight or partial sum
+    double clock_mhz;               //only used to convert cycles to time
+} accel_config_s;
+
+/**
+ * A convolution layer as the accelerator sees it, groups as in conv_layer_s
+ */
+typedef struct {
+    int size;                       //input width and height
+    int channels;
+    int filters;
+    int groups;
+    int kernel_size;
+    int stride;
+} accel_layer_s;
+
+typedef struct {
+    long cycles;
+    long busy_cycles;               //trio cycles spent computing
+    long input_stall_cycles;        //trio cycles waiting for inputs or weights
+    long output_stall_cycles;       //trio cycles waiting for a free output buffer row
+    long idle_cycles;               //trio cycles with no work left to pick up
+    long dram_input_bytes;
+    long dram_weight_bytes;
+    long dram_output_bytes;
+    long input_buffer_bytes;        //on-chip reads and writes of each buffer
+    long weight_buffer_bytes;
+    long output_buffer_bytes;
+    long outputs;
+    long macs;
+    int channels_resident;          //input channels held in the line buffers at once
+    int output_pass_filters;        //filters per pass over an output row
+    int weights_resident;           //all weights loaded once up front
+    double utilization;
+    double macs_per_cycle;
+} accel_report_s;
+
+const char* accel_config_error(const accel_config_s* config, const accel_layer_s* layer);
+void simulate_accelerator(const accel_config_s* config, const accel_layer_s* layer, accel_report_s* report);
+void print_accel_report(const accel_config_s* config, const accel_layer_s* layer, const accel_report_s* report);
+
+#endif
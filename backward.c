@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "backward.h"
+#include "engine.h"
+#include "trace.h"
+
+/**
+ * Backward pass of the FCU convolution
+ *
+ * Over the whole image the trio computes, for every cycle g on the 3x3 window
+ * at (band, t), with x' the window of cycle g - 3 held in the shift registers
+ *
+ *   y_0 = h_0 x_0 + h_1 x'_2 + h_2 x'_1
+ *   y_1 = h_0 x_1 + h_1 x_0  + h_2 x'_2
+ *   y_2 = h_0 x_2 + h_1 x_1  + h_2 x_0
+ *
+ * summed over the three kernel rows. Each feature map entry out[band][j]
+ * takes the one y_k that fcu_output_column() picks for it, the other outputs
+ * are dropped, so a y_k gets the gradient of its entry or none. Both gradients
+ * are the transpose of that network and run on the same multipliers:
+ *
+ * - Input gradient: running three_parallel_fcu backwards in time on the
+ *   output gradient, fed in reverse (g_2, g_1, g_0), gives the window's input
+ *   gradient in reverse. Its shift registers now carry the gradient of cycle
+ *   g + 3 instead of the pixels of g - 3, so it is the same datapath and the
+ *   same 6 multiplies per FCU cycle
+ * - Weight gradient: the transpose of the FCU's output adders turns the three
+ *   output gradients into the gradients of its six products a, b, c, f, g and
+ *   m, each multiplied by the same pre-added pixels the forward pass uses.
+ *   The six sums are folded back into h_0, h_1 and h_2 once at the end
+ *
+ * The shift registers carry across bands, so each tile of bands first primes
+ * them with the three cycles that follow it
+ */
+
+typedef struct {
+    kernel_s* kernel;
+    fcu_storage_t* pixels;
+    fcu_storage_t* grad_out;
+    fcu_storage_t* grad_in;
+    int width;
+    int cycles_per_band;
+    long total_cycles;
+    int tiles;
+    int n_threads;
+} backward_run_s;
+
+typedef struct {
+    backward_run_s* run;
+    int id;
+    fcu_data_t products[3][6];              //gradients of a, b, c, f, g, m summed per kernel row
+    long priming_cycles;
+    unsigned long long input_multiplies;
+    unsigned long long weight_multiplies;
+} backward_worker_s;
+
+/**
+ * One input gradient cycle: every FCU of the trio reads the same three output
+ * gradients, reversed, and its reversed outputs are the gradient of its row
+ * of the window
+ */
+static void input_gradient_cycle(fcu_s** fcus, fcu_storage_t* grad, fcu_storage_t* window, int width) {
+    for (int i = 0; i < 3; i++) {
+        fcus[i]->inputs->x_0 = grad + 2;
+        fcus[i]->inputs->x_1 = grad + 1;
+        fcus[i]->inputs->x_2 = grad;
+
+        free(fcus[i]->outputs);
+        fcus[i]->outputs = three_parallel_fcu(fcus[i]->inputs, fcus[i]->h, fcus[i]->shift_reg_1, fcus[i]->shift_reg_2);
+
+        if (window == NULL) continue;
+        fcu_storage_t* row = window + width * i;
+        row[0] = data_to_storage(storage_to_data(row[0]) + fcus[i]->outputs->y_2);
+        row[1] = data_to_storage(storage_to_data(row[1]) + fcus[i]->outputs->y_1);
+        row[2] = data_to_storage(storage_to_data(row[2]) + fcus[i]->outputs->y_0);
+    }
+}
+
+/**
+ * One weight gradient cycle for the FCU of one kernel row
+ *
+ * shift_reg_1 and shift_reg_2 delay g_0 and g_1 by three cycles, which is
+ * where the forward pass reads x'. Without x the cycle only primes them
+ */
+static void weight_gradient_cycle(fcu_s* fcu, fcu_storage_t* x, fcu_storage_t* grad, fcu_data_t* products) {
+    fcu_data_t g_0 = storage_to_data(grad[0]);
+    fcu_data_t g_1 = storage_to_data(grad[1]);
+    fcu_data_t g_2 = storage_to_data(grad[2]);
+
+    //gradients of cycle g + 3, this is running backwards
+    fcu_data_t g_0_next = dequeue(fcu->shift_reg_1);
+    fcu_data_t g_1_next = dequeue(fcu->shift_reg_2);
+    enqueue(fcu->shift_reg_1, g_0);
+    enqueue(fcu->shift_reg_2, g_1);
+    if (x == NULL) return;
+
+    fcu_data_t x_0 = storage_to_data(x[0]);
+    fcu_data_t x_1 = storage_to_data(x[1]);
+    fcu_data_t x_2 = storage_to_data(x[2]);
+
+    //the output adders of three_parallel_fcu, transposed
+    fcu_data_t da = adder(g_0, (-1) * g_1);
+    fcu_data_t db = adder(adder(g_2, g_2), (-1) * adder(g_1, g_0_next));
+    fcu_data_t dc = adder(g_1_next, (-1) * g_0_next);
+    fcu_data_t df = adder(g_1, (-1) * g_2);
+    fcu_data_t dg = adder(g_0_next, (-1) * g_2);
+
+    //the same pre-added pixels d, e and h as the forward pass
+    fcu_data_t d = adder(x_0, x_1);
+    fcu_data_t e = adder(x_1, x_2);
+    fcu_data_t h = adder(d, x_2);
+
+    products[0] += multiplier(x_0, da);
+    products[1] += multiplier(x_1, db);
+    products[2] += multiplier(x_2, dc);
+    products[3] += multiplier(d, df);
+    products[4] += multiplier(e, dg);
+    products[5] += multiplier(h, g_2);
+}
+
+//run global cycle g of both passes, with prime set it only refills the shift registers
+static void backward_cycle(backward_worker_s* worker, fcu_s** input_fcus, fcu_s** weight_fcus, long g, int prime) {
+    backward_run_s* run = worker->run;
+    int width = run->width;
+    int band = (int)(g / run->cycles_per_band);
+    int t = (int)(g % run->cycles_per_band);
+
+    //gradients of the entries this cycle writes, zero for the outputs it drops
+    fcu_storage_t grad[3];
+    for (int k = 0; k < 3; k++) {
+        int col = fcu_output_column(t, run->cycles_per_band - 1, k);
+        grad[k] = col >= 0 ? run->grad_out[band * run->cycles_per_band + col] : data_to_storage(0.0);
+    }
+    fcu_storage_t* window = run->pixels + band * KERNEL_SIZE * width + t;
+
+    unsigned long long start = multiply_count;
+    input_gradient_cycle(input_fcus, grad, prime ? NULL : run->grad_in + band * KERNEL_SIZE * width + t, width);
+    worker->input_multiplies += multiply_count - start;
+
+    start = multiply_count;
+    for (int i = 0; i < 3; i++) {
+        weight_gradient_cycle(weight_fcus[i], prime ? NULL : window + width * i, grad, worker->products[i]);
+    }
+    worker->weight_multiplies += multiply_count - start;
+}
+
+static void* backward_worker(void* arg) {
+    backward_worker_s* worker = (backward_worker_s*)arg;
+    backward_run_s* run = worker->run;
+    fcu_s* input_fcus[3];
+    fcu_s* weight_fcus[3];
+
+    multiply_count = 0;
+    trace_thread_name("backward worker");
+    init_fcu_trio(input_fcus, run->kernel, "bwd_in");
+    init_fcu_trio(weight_fcus, run->kernel, "bwd_w");
+
+    long tile_cycles = (long)BACKWARD_TILE_BANDS * run->cycles_per_band;
+    for (int tile = worker->id; tile < run->tiles; tile += run->n_threads) {
+        TRACE_SCOPE("backward tile");
+        long first = tile * tile_cycles;
+        long last = first + tile_cycles < run->total_cycles ? first + tile_cycles : run->total_cycles;
+
+        reset_fcu_trio(input_fcus);
+        reset_fcu_trio(weight_fcus);
+
+        //the three cycles after the tile, in the order the tile would have seen them
+        long primed = last + 3 < run->total_cycles ? last + 3 : run->total_cycles;
+        for (long g = primed - 1; g >= last; g--) {
+            backward_cycle(worker, input_fcus, weight_fcus, g, 1);
+            worker->priming_cycles++;
+        }
+
+        for (long g = last - 1; g >= first; g--) {
+            backward_cycle(worker, input_fcus, weight_fcus, g, 0);
+        }
+    }
+
+    free_fcu_trio(input_fcus);
+    free_fcu_trio(weight_fcus);
+    return NULL;
+}
+
+/**
+ * Gradients of a loss through the FCU convolution of one image
+ *
+ * @param kernel Kernel of the forward pass
+ * @param pixels The image, width x width
+ * @param grad_out Gradient of the loss for each feature map entry, dense
+ *                 width / KERNEL_SIZE rows of width - KERNEL_SIZE + 1
+ * @param width Width of the image
+ * @param grad_in Zeroed, receives the gradient for each pixel, width x width
+ * @param grad_weights Receives the gradient for each kernel weight
+ * @param n_threads Worker threads, tiles of BACKWARD_TILE_BANDS bands are dealt out round robin
+ * @param stats Cycle and multiply counts
+ */
+void fcu_backward(kernel_s* kernel, fcu_storage_t* pixels, fcu_storage_t* grad_out, int width,
+                  fcu_storage_t* grad_in, fcu_data_t grad_weights[3][3], int n_threads, backward_stats_s* stats) {
+    backward_run_s run;
+    run.kernel = kernel;
+    run.pixels = pixels;
+    run.grad_out = grad_out;
+    run.grad_in = grad_in;
+    run.width = width;
+    run.cycles_per_band = width - KERNEL_SIZE + 1;
+    run.total_cycles = (long)(width / KERNEL_SIZE) * run.cycles_per_band;
+    run.tiles = (width / KERNEL_SIZE + BACKWARD_TILE_BANDS - 1) / BACKWARD_TILE_BANDS;
+    if (n_threads > run.tiles) n_threads = run.tiles;
+    if (n_threads < 1) n_threads = 1;
+    run.n_threads = n_threads;
+
+    backward_worker_s* workers = (backward_worker_s*)calloc(n_threads, sizeof(backward_worker_s));
+    pthread_t* threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed for backward workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        workers[t].run = &run;
+        workers[t].id = t;
+        if (pthread_create(&threads[t], NULL, backward_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Could not start backward worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(stats, 0, sizeof(backward_stats_s));
+    stats->cycles = run.total_cycles;
+    stats->tiles = run.tiles;
+    fcu_data_t products[3][6];
+    memset(products, 0, sizeof(products));
+    for (int t = 0; t < n_threads; t++) {
+        pthread_join(threads[t], NULL);
+        stats->priming_cycles += workers[t].priming_cycles;
+        stats->input_multiplies += workers[t].input_multiplies;
+        stats->weight_multiplies += workers[t].weight_multiplies;
+        for (int r = 0; r < 3; r++) {
+            for (int p = 0; p < 6; p++) products[r][p] += workers[t].products[r][p];
+        }
+    }
+
+    //h_01 = h_0 + h_1, h_12 = h_1 + h_2 and h_012 feed every tap they sum
+    for (int r = 0; r < 3; r++) {
+        fcu_data_t* p = products[r];
+        grad_weights[r][0] = p[0] + p[3] + p[5];
+        grad_weights[r][1] = p[1] + p[3] + p[4] + p[5];
+        grad_weights[r][2] = p[2] + p[4] + p[5];
+    }
+
+    free(workers);
+    free(threads);
+}
+
+/**
+ * Loss of the numerical check, 0.5 * sum(out^2) of a serial forward pass
+ * The map is summed in double so narrow storage types do not round away the
+ * small changes the differences look for
+ */
+static double forward_loss(fcu_s** fcus, fcu_storage_t* pixels, int width, double* out) {
+    int bands = width / KERNEL_SIZE;
+    int last = width - KERNEL_SIZE;
+    int cols = last + 1;
+    fcu_outputs_s results;
+    memset(out, 0, (size_t)bands * cols * sizeof(double));
+    reset_fcu_trio(fcus);
+    for (int band = 0; band < bands; band++) {
+        for (int t = 0; t <= last; t += STRIDE) {
+            fcu_trio_cycle(fcus, pixels + band * KERNEL_SIZE * width + t, width, &results);
+            fcu_data_t y[3] = { results.y_0, results.y_1, results.y_2 };
+            for (int k = 0; k < 3; k++) {
+                int col = fcu_output_column(t, last, k);
+                if (col >= 0) out[band * cols + col] = y[k];
+            }
+        }
+    }
+
+    double loss = 0;
+    for (int i = 0; i < bands * cols; i++) loss += 0.5 * out[i] * out[i];
+    return loss;
+}
+
+static void set_kernel_weight(fcu_coefficients_s* row, int tap, fcu_data_t value) {
+    if (tap == 0) row->h_0 = value;
+    if (tap == 1) row->h_1 = value;
+    if (tap == 2) row->h_2 = value;
+    row->h_01 = row->h_0 + row->h_1;
+    row->h_12 = row->h_1 + row->h_2;
+    row->h_012 = row->h_0 + row->h_1 + row->h_2;
+}
+
+/**
+ * Check gradients from fcu_backward() against central differences of the
+ * loss 0.5 * sum(out^2), whose gradient for the feature map is the map itself
+ *
+ * The loss is quadratic so central differences are exact apart from rounding.
+ * Every weight and BACKWARD_CHECK_PIXELS pixels are checked, each with a step
+ * of 1, which every storage type holds exactly for 8-bit pixels
+ *
+ * @param kernel Kernel of the forward pass, restored before returning
+ * @param pixels The image, restored before returning
+ * @param width Width of the image
+ * @param grad_in Input gradient to check
+ * @param grad_weights Weight gradient to check
+ * @param check Largest errors relative to the largest gradient of each kind
+ */
+void check_backward(kernel_s* kernel, fcu_storage_t* pixels, int width, fcu_storage_t* grad_in,
+                    fcu_data_t grad_weights[3][3], backward_check_s* check) {
+    fcu_s* fcus[3];
+    init_fcu_trio(fcus, kernel, "check");
+    double* out = (double*)malloc((size_t)(width / KERNEL_SIZE) * (width - KERNEL_SIZE + 1) * sizeof(double));
+    if (out == NULL) {
+        fprintf(stderr, "Memory allocation failed for gradient check\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fcu_coefficients_s* rows[3] = { kernel->kernel_row_1, kernel->kernel_row_2, kernel->kernel_row_3 };
+    double max_grad = 0, max_error = 0;
+    for (int r = 0; r < 3; r++) {
+        for (int tap = 0; tap < 3; tap++) {
+            fcu_data_t* weight = tap == 0 ? &rows[r]->h_0 : tap == 1 ? &rows[r]->h_1 : &rows[r]->h_2;
+            fcu_data_t value = *weight;
+
+            set_kernel_weight(rows[r], tap, value + 1);
+            double plus = forward_loss(fcus, pixels, width, out);
+            set_kernel_weight(rows[r], tap, value - 1);
+            double minus = forward_loss(fcus, pixels, width, out);
+            set_kernel_weight(rows[r], tap, value);
+
+            double numerical = (plus - minus) / 2;
+            double error = numerical - grad_weights[r][tap];
+            if (error < 0) error = -error;
+            if (error > max_error) max_error = error;
+            if (numerical > max_grad) max_grad = numerical;
+            if (-numerical > max_grad) max_grad = -numerical;
+        }
+    }
+    check->weight_error = max_grad > 0 ? max_error / max_grad : max_error;
+
+    //a fixed LCG keeps the sampled pixels the same between runs
+    unsigned int seed = 12345;
+    int n_pixels = width * width;
+    check->pixels_checked = n_pixels < BACKWARD_CHECK_PIXELS ? n_pixels : BACKWARD_CHECK_PIXELS;
+    max_grad = 0;
+    max_error = 0;
+    for (int s = 0; s < check->pixels_checked; s++) {
+        int idx = s;
+        if (n_pixels > BACKWARD_CHECK_PIXELS) {
+            seed = seed * 1103515245 + 12345;
+            idx = (int)((seed >> 8) % n_pixels);
+        }
+        fcu_storage_t value = pixels[idx];
+
+        pixels[idx] = data_to_storage(storage_to_data(value) + 1);
+        double plus = forward_loss(fcus, pixels, width, out);
+        pixels[idx] = data_to_storage(storage_to_data(value) - 1);
+        double minus = forward_loss(fcus, pixels, width, out);
+        pixels[idx] = value;
+
+        double numerical = (plus - minus) / 2;
+        double error = numerical - storage_to_data(grad_in[idx]);
+        if (error < 0) error = -error;
+        if (error > max_error) max_error = error;
+        if (numerical > max_grad) max_grad = numerical;
+        if (-numerical > max_grad) max_grad = -numerical;
+    }
+    check->input_error = max_grad > 0 ? max_error / max_grad : max_error;
+
+    free(out);
+    free_fcu_trio(fcus);
+}
@@ -0,0 +1,40 @@
+#ifndef BACKWARD_H
+#define BACKWARD_H
+
+#include "fcu.h"
+
+//bands per tile of the backward pass, tiles are dealt out to the threads
+#define BACKWARD_TILE_BANDS 4
+
+//pixels sampled by the numerical gradient check
+#define BACKWARD_CHECK_PIXELS 256
+
+//relative error the check accepts, the narrow storage types round the feature map
+#if FCU_PRECISION == FCU_PRECISION_DOUBLE
+#define BACKWARD_CHECK_TOLERANCE 1e-9
+#elif FCU_PRECISION == FCU_PRECISION_FLOAT
+#define BACKWARD_CHECK_TOLERANCE 1e-4
+#else
+#define BACKWARD_CHECK_TOLERANCE 2e-2
+#endif
+
+typedef struct {
+    long cycles;                            //FCU cycles of each pass, the same as the forward pass
+    long priming_cycles;                    //extra cycles refilling the shift registers at tile starts
+    int tiles;
+    unsigned long long input_multiplies;
+    unsigned long long weight_multiplies;
+} backward_stats_s;
+
+typedef struct {
+    double weight_error;                    //largest error relative to the largest gradient
+    double input_error;
+    int pixels_checked;
+} backward_check_s;
+
+void fcu_backward(kernel_s* kernel, fcu_storage_t* pixels, fcu_storage_t* grad_out, int width,
+                  fcu_storage_t* grad_in, fcu_data_t grad_weights[3][3], int n_threads, backward_stats_s* stats);
+void check_backward(kernel_s* kernel, fcu_storage_t* pixels, int width, fcu_storage_t* grad_in,
+                    fcu_data_t grad_weights[3][3], backward_check_s* check);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "engine.h"
+
+//initialize an FCU
+fcu_s* init_fcu(fcu_s* fcu, char* fcu_name) {
+    //create a pointer to a fcu_s structure and assign it to the the value of the pointer passed into the arg
+    fcu = (fcu_s*)malloc(sizeof(fcu_s));
+    
+    if (fcu == NULL) {
+        fprintf(stderr, "Memory allocation failed for FCU\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // init the inpiuts struct
+    (fcu)->inputs = (fcu_inputs_s*)malloc(sizeof(fcu_inputs_s));
+    if ((fcu)->inputs == NULL) {
+        fprintf(stderr, "Memory allocation failed for FCU inputs\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Initialize coefficients
+    (fcu)->h = (fcu_coefficients_s*)malloc(sizeof(fcu_coefficients_s));
+    if ((fcu)->h == NULL) {
+        fprintf(stderr, "Memory allocation failed for FCU coefficients\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Initialize shift regs, named after the FCU
+    char* name_a = (char*)malloc(strlen(fcu_name) + 6);
+    char* name_b = (char*)malloc(strlen(fcu_name) + 6);
+    if (name_a == NULL || name_b == NULL) {
+        fprintf(stderr, "Memory allocation failed for shift register names\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(name_a, "%s_sr_a", fcu_name);
+    sprintf(name_b, "%s_sr_b", fcu_name);
+    init_shift_reg(&((fcu)->shift_reg_1), name_a);
+    init_shift_reg(&((fcu)->shift_reg_2), name_b);
+
+    // Initialize outputs struct
+    (fcu)->outputs = (fcu_outputs_s*)malloc(sizeof(fcu_outputs_s));
+    if ((fcu)->outputs == NULL) {
+        fprintf(stderr, "Memory allocation failed for FCU outputs\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return fcu;
+}
+
+/**
+ * Initialize the three FCUs of a trio and point each at its kernel row
+ *
+ * @param fcus Array of three FCU pointers to fill in
+ * @param kernel Kernel whose rows the FCUs filter with
+ * @param name Prefix for the FCU names, FCU i is called <name>_<i>
+ */
+void init_fcu_trio(fcu_s** fcus, kernel_s* kernel, char* name) {
+    for (int i = 0; i < 3; i++) {
+        char* fcu_name = (char*)malloc(strlen(name) + 4);
+        if (fcu_name == NULL) {
+            fprintf(stderr, "Memory allocation failed for FCU name\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(fcu_name, "%s_%d", name, i + 1);
+        fcus[i] = init_fcu(fcus[i], fcu_name);
+        free(fcu_name);
+
+        //the kernel rows below replace the coefficients init_fcu() allocated
+        free(fcus[i]->h);
+    }
+
+    //Each FCU has a set of FIR filter coefficients. These coefficients are stored in the variable 'kernel'
+    //Basically assign each FCU's 'h' var to point to the correct set of filter coefficients
+    fcus[0]->h = kernel->kernel_row_1;
+    fcus[1]->h = kernel->kernel_row_2;
+    fcus[2]->h = kernel->kernel_row_3;
+}
+
+/**
+ * Free a trio set up by init_fcu_trio()
+ * The kernel rows belong to the kernel and are left alone
+ */
+void free_fcu_trio(fcu_s** fcus) {
+    for (int i = 0; i < 3; i++) {
+        free_shift_reg(fcus[i]->shift_reg_1);
+        free_shift_reg(fcus[i]->shift_reg_2);
+        free(fcus[i]->inputs);
+        free(fcus[i]->outputs);
+        free(fcus[i]);
+        fcus[i] = NULL;
+    }
+}
+
+/**
+ * Run one clock cycle of the FCU trio on a 3x3 window
+ *
+ * FCU i reads row i of the window and the three outputs are summed into results
+ *
+ * @param fcus The three FCUs, with h already pointing at their kernel rows
+ * @param window Top left pixel of the window
+ * @param width Width of the image in pixels
+ * @param results Combined y_0, y_1 and y_2 of the trio
+ */
+void fcu_trio_cycle(fcu_s** fcus, fcu_storage_t* window, int width, fcu_outputs_s* results) {
+    for (int i = 0; i < 3; i++) {
+        fcus[i]->inputs->x_0 = window + (width*i);
+        fcus[i]->inputs->x_1 = window + (width*i) + 1;
+        fcus[i]->inputs->x_2 = window + (width*i) + 2;
+
+        free(fcus[i]->outputs);
+        fcus[i]->outputs = three_parallel_fcu(fcus[i]->inputs, fcus[i]->h, fcus[i]->shift_reg_1, fcus[i]->shift_reg_2);
+    }
+
+    //combine the outputs of each fcu into one fcu_outputs struct
+    results->y_0 = fcus[0]->outputs->y_0 + fcus[1]->outputs->y_0 + fcus[2]->outputs->y_0;
+    results->y_1 = fcus[0]->outputs->y_1 + fcus[1]->outputs->y_1 + fcus[2]->outputs->y_1;
+    results->y_2 = fcus[0]->outputs->y_2 + fcus[1]->outputs->y_2 + fcus[2]->outputs->y_2;
+}
+
+/**
+ * Output column y_k of cycle t of a band lands in, -1 if it is dropped
+ *
+ * y_k of cycle t is the output of the window starting at column t + k - 2, so
+ * at stride 1 every column is produced three times: by y_2 of cycle j, y_1 of
+ * cycle j + 1 and y_0 of cycle j + 2. y_0 and y_1 are only exact from cycle 3
+ * on, before that the shift registers still hold the previous band. Each
+ * column is taken from its last exact producer, so it is written exactly once
+ *
+ * @param t Cycle within the band
+ * @param last Last cycle of the band
+ * @param k Which output, 0 to 2
+ */
+int fcu_output_column(int t, int last, int k) {
+    int col = t + k - 2;
+    if (k == 0) return t >= 3 ? col : -1;
+    if (k == 1) return t >= 3 && t == last ? col : -1;
+    //y_2 unless a later exact y_0 or y_1 still reaches the column
+    return t == 0 || t == last || (t == 1 && last < 3) ? col : -1;
+}
+
+/**
+ * Add one cycle's combined outputs to their columns of an output row
+ *
+ * @param out Column 0 of the output row
+ * @param stride Elements between columns, the block size of the layout
+ * @param t Cycle within the band
+ * @param last Last cycle of the band
+ * @param results Combined outputs of the trio
+ */
+void store_fcu_outputs(fcu_storage_t* out, int stride, int t, int last, fcu_outputs_s* results) {
+    fcu_data_t y[3] = { results->y_0, results->y_1, results->y_2 };
+    for (int k = 0; k < 3; k++) {
+        int col = fcu_output_column(t, last, k);
+        if (col < 0) continue;
+        out[col * stride] = data_to_storage(storage_to_data(out[col * stride]) + y[k]);
+    }
+}
+
+/**
+ * Run the FCU trio across one band of KERNEL_SIZE image rows
+ *
+ * Every cycle the three FCUs run on the current window, their outputs are
+ * summed and added to their columns of the band's output row, then the window
+ * slides by STRIDE
+ *
+ * The shift registers are not reset here, state carries over from the previous
+ * band exactly like the hardware does when the kernel wraps to the next rows
+ *
+ * @param fcus The three FCUs, with h already pointing at their kernel rows
+ * @param rows First pixel of the band, KERNEL_SIZE rows of width pixels
+ * @param width Width of the image in pixels
+ * @param out Column 0 of the band's output row
+ * @param stride Elements between output columns, the block size of the layout
+ * @param idx_base Feature map index of out[0], only used for the hook
+ * @param hook Optional per-cycle callback for debug output, may be NULL
+ * @return Number of FCU cycles run
+ */
+int fcu_convolve_band(fcu_s** fcus, fcu_storage_t* rows, int width, fcu_storage_t* out, int stride,
+                      int idx_base, fcu_cycle_hook_t hook) {
+    fcu_outputs_s results;
+    int cycles = 0;
+    int last = width - KERNEL_SIZE;
+
+    for (int t = 0; t <= last; t += STRIDE) {
+        fcu_trio_cycle(fcus, rows + t, width, &results);
+        store_fcu_outputs(out, stride, t, last, &results);
+        cycles++;
+
+        if (hook != NULL) hook(&results, idx_base + t - 2);
+    }
+
+    return cycles;
+}
+
+/**
+ * Clear the shift registers of all three FCUs
+ * Used when the trio starts on a new, unrelated image
+ */
+void reset_fcu_trio(fcu_s** fcus) {
+    for (int i = 0; i < 3; i++) {
+        reset_shift_reg(fcus[i]->shift_reg_1);
+        reset_shift_reg(fcus[i]->shift_reg_2);
+    }
+}
+
+/**
+ * Copy the shift register contents of the trio out to / back from state
+ * state holds FCU_TRIO_STATE_SIZE values, head to tail for each register
+ */
+void save_fcu_trio_state(fcu_s** fcus, fcu_data_t* state) {
+    for (int i = 0; i < 3; i++) {
+        queue_s* regs[2] = { fcus[i]->shift_reg_1, fcus[i]->shift_reg_2 };
+        for (int r = 0; r < 2; r++) {
+            *state++ = regs[r]->head->data;
+            *state++ = regs[r]->middle->data;
+            *state++ = regs[r]->tail->data;
+        }
+    }
+}
+
+void load_fcu_trio_state(fcu_s** fcus, fcu_data_t* state) {
+    for (int i = 0; i < 3; i++) {
+        queue_s* regs[2] = { fcus[i]->shift_reg_1, fcus[i]->shift_reg_2 };
+        for (int r = 0; r < 2; r++) {
+            regs[r]->head->data = *state++;
+            regs[r]->middle->data = *state++;
+            regs[r]->tail->data = *state++;
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "fcu.h"
+
+/**
+ * Called after every FCU cycle with the combined outputs of the trio
+ * idx is the feature map index of the column y_0 belongs to, y_1 and y_2 follow
+ */
+typedef void (*fcu_cycle_hook_t)(fcu_outputs_s* results, int idx);
+
+//shift register values held by the trio, 3 FCUs x 2 registers x 3 stages
+#define FCU_TRIO_STATE_SIZE 18
+
+fcu_s* init_fcu(fcu_s* fcu, char* fcu_name);
+void init_fcu_trio(fcu_s** fcus, kernel_s* kernel, char* name);
+void free_fcu_trio(fcu_s** fcus);
+void fcu_trio_cycle(fcu_s** fcus, fcu_storage_t* window, int width, fcu_outputs_s* results);
+int fcu_output_column(int t, int last, int k);
+void store_fcu_outputs(fcu_storage_t* out, int stride, int t, int last, fcu_outputs_s* results);
+int fcu_convolve_band(fcu_s** fcus, fcu_storage_t* rows, int width, fcu_storage_t* out, int stride,
+                      int idx_base, fcu_cycle_hook_t hook);
+void reset_fcu_trio(fcu_s** fcus);
+void save_fcu_trio_state(fcu_s** fcus, fcu_data_t* state);
+void load_fcu_trio_state(fcu_s** fcus, fcu_data_t* state);
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+
+#include "epilogue.h"
+#include "engine.h"
+
+//fold one finished entry into its pooling window
+static void pool_value(fcu_storage_t* pooled, int pool, int col, int cols, fcu_data_t v) {
+    if (pooled == NULL || col >= (cols / pool) * pool) return;
+    fcu_storage_t* slot = pooled + col / pool;
+    if (v > storage_to_data(*slot)) *slot = data_to_storage(v);
+}
+
+/**
+ * Fill a row of the pooled map with the lowest value before its first band
+ */
+void init_pooled_row(fcu_storage_t* pooled, int cols, int pool) {
+    for (int i = 0; i < cols / pool; i++) {
+        pooled[i] = data_to_storage(-FLT_MAX);
+    }
+}
+
+/**
+ * Same as fcu_convolve_band() but runs the epilogue on each entry as soon as
+ * it is complete, so the map is only stored once
+ *
+ * Every column of the row is written by exactly one output of one cycle, see
+ * fcu_output_column(), so that write finishes it. The epilogue cannot run on
+ * the FCU output on its own when other input channels were added before, since
+ * a nonlinearity does not distribute over that sum; instead it runs on the
+ * stored partial sum plus the output
+ *
+ * out may already hold partial sums from other input channels, in that case
+ * only the band of the last channel should go through here
+ *
+ * @param fcus The three FCUs, with h already pointing at their kernel rows
+ * @param rows First pixel of the band, KERNEL_SIZE rows of width pixels
+ * @param width Width of the image in pixels
+ * @param out Column 0 of the band's output row
+ * @param stride Elements between output columns, the block size of the layout
+ * @param epilogue Stages to apply
+ * @param bias Bias of this filter from epilogue_bias()
+ * @param pooled Row of the pooled map this band folds into, NULL for none
+ * @return Number of FCU cycles run
+ */
+int fcu_convolve_band_epilogue(fcu_s** fcus, fcu_storage_t* rows, int width, fcu_storage_t* out, int stride,
+                               const epilogue_s* epilogue, fcu_data_t bias, fcu_storage_t* pooled) {
+    fcu_outputs_s results;
+    int cycles = 0;
+    int last = width - KERNEL_SIZE;
+    int cols = last / STRIDE + 1;
+
+    for (int t = 0; t <= last; t += STRIDE) {
+        fcu_trio_cycle(fcus, rows + t, width, &results);
+        fcu_data_t y[3] = { results.y_0, results.y_1, results.y_2 };
+
+        for (int k = 0; k < 3; k++) {
+            int col = fcu_output_column(t, last, k);
+            if (col < 0) continue;
+            fcu_data_t v = apply_epilogue(epilogue, bias, storage_to_data(out[col * stride]) + y[k]);
+            out[col * stride] = data_to_storage(v);
+            pool_value(pooled, epilogue->pool, col, cols, v);
+        }
+        cycles++;
+    }
+
+    return cycles;
+}
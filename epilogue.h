@@ -0,0 +1,81 @@
+#ifndef EPILOGUE_H
+#define EPILOGUE_H
+
+#include "fcu.h"
+
+typedef enum {
+    ACTIVATION_NONE,
+    ACTIVATION_RELU,
+    ACTIVATION_RELU6,
+    ACTIVATION_LEAKY
+} activation_e;
+
+/**
+ * Bias, nonlinearity, clamp and requantization applied to each feature map
+ * entry as it is completed, before it is stored
+ *
+ * Stages run in that order and each one is skipped when left at its zero
+ * value. With pool > 1 the stored values are also max pooled in pool x pool
+ * windows into a separate pooled map
+ */
+typedef struct {
+    fcu_data_t* bias;           //one per filter, NULL for none
+    int n_bias;                 //1 applies the same bias to every filter
+    activation_e activation;
+    fcu_data_t leaky_slope;
+    int clamp;
+    fcu_data_t clamp_min;
+    fcu_data_t clamp_max;
+    int requantize_bits;        //signed integer width, 0 for none
+    fcu_data_t requantize_scale;
+    int requantize_zero_point;
+    int pool;                   //max pooling window, 0 or 1 for none
+} epilogue_s;
+
+static inline fcu_data_t epilogue_bias(const epilogue_s* epilogue, int filter) {
+    if (epilogue->bias == NULL) return 0.0;
+    return epilogue->bias[epilogue->n_bias == 1 ? 0 : filter];
+}
+
+//bias has already been looked up with epilogue_bias(), so this stays branch light
+static inline fcu_data_t apply_epilogue(const epilogue_s* epilogue, fcu_data_t bias, fcu_data_t v) {
+    v += bias;
+
+    switch (epilogue->activation) {
+        case ACTIVATION_RELU:
+            if (v < 0) v = 0;
+            break;
+        case ACTIVATION_RELU6:
+            if (v < 0) v = 0;
+            if (v > 6) v = 6;
+            break;
+        case ACTIVATION_LEAKY:
+            if (v < 0) v *= epilogue->leaky_slope;
+            break;
+        default:
+            break;
+    }
+
+    if (epilogue->clamp) {
+        if (v < epilogue->clamp_min) v = epilogue->clamp_min;
+        if (v > epilogue->clamp_max) v = epilogue->clamp_max;
+    }
+
+    if (epilogue->requantize_bits > 0) {
+        fcu_data_t q_max = (fcu_data_t)((1 << (epilogue->requantize_bits - 1)) - 1);
+        fcu_data_t q_min = -q_max - 1;
+        v = v / epilogue->requantize_scale + epilogue->requantize_zero_point;
+        if (v < q_min) v = q_min;
+        if (v > q_max) v = q_max;
+        //round half away from zero, in range now so the cast cannot overflow
+        v = (fcu_data_t)(long)(v < 0 ? v - 0.5 : v + 0.5);
+    }
+
+    return v;
+}
+
+int fcu_convolve_band_epilogue(fcu_s** fcus, fcu_storage_t* rows, int width, fcu_storage_t* out, int stride,
+                               const epilogue_s* epilogue, fcu_data_t bias, fcu_storage_t* pooled);
+void init_pooled_row(fcu_storage_t* pooled, int cols, int pool);
+
+#endif
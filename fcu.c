@@ -7,16 +7,18 @@
 
 #include "fcu.h"
 
+_Thread_local unsigned long long multiply_count = 0;
 
 /**
- * Multiplier function that takes two double values and returns their product.
+ * Multiplier function that takes two datapath values and returns their product.
  *
- * @param x_0 The first double value.
- * @param h_0 The second double value.
+ * @param x_0 The first value.
+ * @param h_0 The second value.
  * @return The product of x_0 and h_0.
  */
-double multiplier(double x_0, double h_0) {
-    double res = x_0 * h_0;
+fcu_data_t multiplier(fcu_data_t x_0, fcu_data_t h_0) {
+    fcu_data_t res = x_0 * h_0;
+    multiply_count++;
     if (isnan(res)) {
         fprintf(stderr, "Multiplication resulted in NaN\n\t x_0: %f\n\t h_0: %f\n", x_0, h_0);
         exit(EXIT_FAILURE);
@@ -26,14 +28,14 @@ double multiplier(double x_0, double h_0) {
 
 
 /**
- * Adder function that takes two double values and returns their sum.
+ * Adder function that takes two datapath values and returns their sum.
  *
- * @param x_0 The first double value.
- * @param h_0 The second double value.
+ * @param x_0 The first value.
+ * @param h_0 The second value.
  * @return The sum of x_0 and h_0.
  */
-double adder(double x_0, double h_0) {
-    double res = x_0 + h_0;
+fcu_data_t adder(fcu_data_t x_0, fcu_data_t h_0) {
+    fcu_data_t res = x_0 + h_0;
     if (isnan(res)) {
         fprintf(stderr, "Addition resulted in NaN\n");
         exit(EXIT_FAILURE);
@@ -54,9 +56,9 @@ double adder(double x_0, double h_0) {
  * Dequeing is responsible for removing data from the head and shifting the rest of the data accordingly 
  * 
  * @param queue Pointer to the queue_s structure representing the shift register.
- * @param value The double value to be added to the queue.
+ * @param value The value to be added to the queue.
  */
-void enqueue(queue_s* queue, double value) {
+void enqueue(queue_s* queue, fcu_data_t value) {
     //simply assign the value passed in to the tail's data
     queue->tail->data = value;
 
@@ -78,9 +80,9 @@ void enqueue(queue_s* queue, double value) {
  * ---> Set the tail data to be 0.0
  * * @param queue Pointer to the queue_s structure representing the shift register.
  */
-double dequeue(queue_s* queue) {
+fcu_data_t dequeue(queue_s* queue) {
     //save value at the head
-    double value = queue->head->data;
+    fcu_data_t value = queue->head->data;
 
     //shift data from middle to head
     queue->head->data = queue->middle->data;
@@ -137,6 +139,27 @@ void init_shift_reg (queue_s** queue, char* name) {
 
 }
 
+/**
+ * Free the nodes, the name and the queue of a shift register
+ */
+void free_shift_reg(queue_s* queue) {
+    free(queue->head);
+    free(queue->middle);
+    free(queue->tail);
+    free(queue->name);
+    free(queue);
+}
+
+/**
+ * Clear all three stages of a shift register back to 0.0
+ * Equivalent to asserting the register's synchronous reset
+ */
+void reset_shift_reg(queue_s* queue) {
+    queue->head->data = 0.0;
+    queue->middle->data = 0.0;
+    queue->tail->data = 0.0;
+}
+
 
  /**
  * Function that simulates the three-parallel Fast Convolutional Unit (FCU)
@@ -162,37 +185,42 @@ fcu_outputs_s* three_parallel_fcu(
         exit(EXIT_FAILURE);
     }
 
+    //widen the stored pixels into the datapath type
+    fcu_data_t x_0 = storage_to_data(*inputs->x_0);
+    fcu_data_t x_1 = storage_to_data(*inputs->x_1);
+    fcu_data_t x_2 = storage_to_data(*inputs->x_2);
+
     //signal names are single character to make it more readable
     //there is a diagram in this repository that shows what intermediate signals have which names
-    double a = multiplier(*inputs->x_0, kernel->h_0);
-    double b = multiplier(*inputs->x_1, kernel->h_1);
-    double c = multiplier(*inputs->x_2, kernel->h_2);
-    double d = adder(*inputs->x_0, *inputs->x_1);
-    double e = adder(*inputs->x_1, *inputs->x_2);
+    fcu_data_t a = multiplier(x_0, kernel->h_0);
+    fcu_data_t b = multiplier(x_1, kernel->h_1);
+    fcu_data_t c = multiplier(x_2, kernel->h_2);
+    fcu_data_t d = adder(x_0, x_1);
+    fcu_data_t e = adder(x_1, x_2);
 
     //second layer of combinational logic
-    double f = multiplier(d, kernel->h_01);
-    double g = multiplier(e, kernel->h_12);
-    double h = adder(d, *inputs->x_2);
-    double j = adder(a, (-1) * dequeue(shift_reg_1));
+    fcu_data_t f = multiplier(d, kernel->h_01);
+    fcu_data_t g = multiplier(e, kernel->h_12);
+    fcu_data_t h = adder(d, x_2);
+    fcu_data_t j = adder(a, (-1) * dequeue(shift_reg_1));
     //need to do this after dequeueing from shift_reg_1
     //in hw, the SR would accept the value on the same clk edge that we dequeue from it
     enqueue(shift_reg_1, c); //enqueue x2h2 into the shift register (3x shift register)
 
     //third layer
-    double m = multiplier(h, kernel->h_012);
-    double k = adder(f, ((-1)*b));
-    double l = adder(g, ((-1)*b));
-    double y0 = adder(j, dequeue(shift_reg_2));
+    fcu_data_t m = multiplier(h, kernel->h_012);
+    fcu_data_t k = adder(f, ((-1)*b));
+    fcu_data_t l = adder(g, ((-1)*b));
+    fcu_data_t y0 = adder(j, dequeue(shift_reg_2));
 
     
     //fourth layer
-    double p  = adder(m, (-1)*k);
-    double y1 = adder(k, (-1)*j);
+    fcu_data_t p  = adder(m, (-1)*k);
+    fcu_data_t y1 = adder(k, (-1)*j);
     enqueue(shift_reg_2, l);
 
     //fifth layer
-    double y2 = adder(p, (-1)*l);
+    fcu_data_t y2 = adder(p, (-1)*l);
 
 
     outputs->y_0 = y0;
@@ -2,11 +2,13 @@
 #ifndef FCU_H
 #define FCU_H
 
+#include "precision.h"
+
 
  //struct for the shift register
  //queue implemented as a linked list with head and tail pointers
  typedef struct {
-     double data;
+     fcu_data_t data;
      struct shift_reg_node_s* next;
  } shift_reg_node_s;
 
@@ -29,7 +31,6 @@ void print_shift_reg(queue_s* queue);
 #define DEBUG_FCU_OUTPUTS 1
 
 #define DEBUG_STEP_THRU 0
-#endif 
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,26 +38,26 @@ void print_shift_reg(queue_s* queue);
 //define a struct for the inputs for the FCU
 
 typedef struct {
-    double* x_0;
-    double* x_1; 
-    double* x_2;
+    fcu_storage_t* x_0;
+    fcu_storage_t* x_1; 
+    fcu_storage_t* x_2;
 } fcu_inputs_s;
 
 //struct for the FIRs impulse response coefficients
 typedef struct {
-    double h_0;
-    double h_1;
-    double h_2;
-    double h_01;
-    double h_12;
-    double h_012;
+    fcu_data_t h_0;
+    fcu_data_t h_1;
+    fcu_data_t h_2;
+    fcu_data_t h_01;
+    fcu_data_t h_12;
+    fcu_data_t h_012;
 } fcu_coefficients_s;
 
 //struct for the outputs of the FCU
 typedef struct {
-    double y_0;
-    double y_1;
-    double y_2;
+    fcu_data_t y_0;
+    fcu_data_t y_1;
+    fcu_data_t y_2;
 } fcu_outputs_s;
 
 typedef struct {
@@ -98,16 +99,40 @@ typedef struct {
 const static int STRIDE = 1;
 const static int KERNEL_SIZE = 3; //3x3 kernel
 
+/**
+ * Convolution engines that can be selected per run with --engine
+ *
+ * ENGINE_FCU         - three 1D 3-parallel fast FIR units, one per kernel row
+ * ENGINE_WINOGRAD_F2 - 2D Winograd minimal filtering F(2x2, 3x3)
+ * ENGINE_WINOGRAD_F4 - 2D Winograd minimal filtering F(4x4, 3x3)
+ */
+typedef enum {
+    ENGINE_FCU,
+    ENGINE_WINOGRAD_F2,
+    ENGINE_WINOGRAD_F4
+} conv_engine_e;
+
+/**
+ * Number of hardware multiplies performed through multiplier()
+ * Reset before the convolution loop so setup work is not counted
+ * Kept per thread, threaded engines add their workers' counts up themselves
+ */
+extern _Thread_local unsigned long long multiply_count;
 
 
-double multiplier(double x_0, double h_0);
-double adder(double x_0, double x_1);
-void enqueue(queue_s* queue, double value);
-double dequeue(queue_s* queue);
+
+fcu_data_t multiplier(fcu_data_t x_0, fcu_data_t h_0);
+fcu_data_t adder(fcu_data_t x_0, fcu_data_t x_1);
+void enqueue(queue_s* queue, fcu_data_t value);
+fcu_data_t dequeue(queue_s* queue);
 fcu_outputs_s* three_parallel_fcu(  fcu_inputs_s* inputs, 
                                     fcu_coefficients_s* kernel, 
                                     queue_s* shift_reg_1, 
                                     queue_s* shift_reg_2
                                     );
 
-void init_shift_reg(queue_s** queue, char* name);
\ No newline at end of file
+void init_shift_reg(queue_s** queue, char* name);
+void reset_shift_reg(queue_s* queue);
+void free_shift_reg(queue_s* queue);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "incremental.h"
+#include "engine.h"
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+/**
+ * Recompute columns [first, last_col] of one band's output row
+ *
+ * Column c is written by the cycle min(c + 2, last) (cycle 0 for column 0),
+ * and y_0 and y_1 are exact once the trio has run three cycles since its
+ * registers were cleared. Starting three cycles before the first column's
+ * producer therefore makes every producer of the segment exact, and any
+ * output of the priming cycles lands left of the segment and is dropped
+ *
+ * @return Number of FCU cycles run
+ */
+static int recompute_segment(incremental_map_s* map, int band, int first, int last_col) {
+    int width = map->size;
+    int last = width - KERNEL_SIZE;
+    int t0 = first == 0 ? 0 : max_int(min_int(first + 2, last) - 3, 0);
+    int t1 = min_int(last_col + 2, last);
+    fcu_storage_t* rows = map->pixels + band * KERNEL_SIZE * width;
+    fcu_storage_t* out = layout_row(&map->layout, map->map, 0, band);
+    int stride = map->layout.block;
+    fcu_outputs_s results;
+
+    //the outputs are added like a full pass does, so an update gives the same bits
+    for (int c = first; c <= last_col; c++) out[c * stride] = data_to_storage(0.0);
+
+    reset_fcu_trio(map->fcus);
+    for (int t = t0; t <= t1; t += STRIDE) {
+        fcu_trio_cycle(map->fcus, rows + t, width, &results);
+
+        fcu_data_t y[3] = { results.y_0, results.y_1, results.y_2 };
+        for (int k = 0; k < 3; k++) {
+            int col = fcu_output_column(t, last, k);
+            if (col < first || col > last_col) continue;
+            out[col * stride] = data_to_storage(storage_to_data(out[col * stride]) + y[k]);
+        }
+    }
+
+    return t1 - t0 + 1;
+}
+
+/**
+ * Convolve the whole image once into a new persisted feature map
+ *
+ * @param map Set up here
+ * @param kernel Kernel the map is convolved with, used by reference
+ * @param pixels size x size image, edited by the caller between updates
+ * @param size Width of the image in pixels, a multiple of STRIDE
+ * @return The map
+ */
+incremental_map_s* init_incremental_map(incremental_map_s* map, kernel_s* kernel, fcu_storage_t* pixels, int size) {
+    map = (incremental_map_s*)malloc(sizeof(incremental_map_s));
+    if (map == NULL) {
+        fprintf(stderr, "Memory allocation failed for incremental map\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(map, 0, sizeof(incremental_map_s));
+
+    map->size = size;
+    map->pixels = pixels;
+    map->layout = fcu_output_layout(size, 0, 1, 1);
+    map->map = alloc_layout(&map->layout);
+    init_fcu_trio(map->fcus, kernel, "incremental");
+
+    image_rect_s whole = { 0, 0, size, size };
+    update_incremental_map(map, &whole, NULL);
+    map->updates = 0;
+    return map;
+}
+
+/**
+ * Bring the feature map up to date after the pixels of dirty changed
+ *
+ * The affected outputs are those whose 3x3 window overlaps dirty: the bands
+ * holding its rows and the columns from dirty->col - 2 to its last column.
+ * Each of those bands reruns one segment from empty shift registers
+ *
+ * @param map Map from init_incremental_map()
+ * @param dirty Changed pixels, clipped to the image
+ * @param affected Set to the rewritten outputs in feature map coordinates, may be NULL
+ * @return Number of FCU cycles run, 0 if no output is affected
+ */
+long update_incremental_map(incremental_map_s* map, const image_rect_s* dirty, image_rect_s* affected) {
+    int first_row = max_int(dirty->row, 0);
+    int last_row = min_int(dirty->row + dirty->rows, map->size) - 1;
+    int first_col = max_int(dirty->col, 0);
+    int last_col = min_int(dirty->col + dirty->cols, map->size) - 1;
+
+    //rows below the last whole band are not convolved
+    int first_band = first_row / KERNEL_SIZE;
+    int last_band = min_int(last_row / KERNEL_SIZE, map->layout.rows - 1);
+    int first_out = max_int(first_col - (KERNEL_SIZE - 1), 0);
+    int last_out = min_int(last_col, map->layout.cols - 1);
+
+    if (affected != NULL) memset(affected, 0, sizeof(image_rect_s));
+    if (first_row > last_row || first_col > last_col || first_band > last_band || first_out > last_out) return 0;
+
+    long cycles = 0;
+    for (int band = first_band; band <= last_band; band++) {
+        cycles += recompute_segment(map, band, first_out, last_out);
+    }
+
+    if (affected != NULL) {
+        affected->row = first_band;
+        affected->col = first_out;
+        affected->rows = last_band - first_band + 1;
+        affected->cols = last_out - first_out + 1;
+    }
+    map->updates++;
+    map->cycles_run += cycles;
+    return cycles;
+}
+
+void free_incremental_map(incremental_map_s* map) {
+    free_fcu_trio(map->fcus);
+    free(map->map);
+    free(map);
+}
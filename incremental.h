@@ -0,0 +1,41 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "fcu.h"
+#include "layout.h"
+
+/**
+ * Rectangle of an image or feature map, rows x cols starting at (row, col)
+ */
+typedef struct {
+    int row;
+    int col;
+    int rows;
+    int cols;
+} image_rect_s;
+
+/**
+ * A feature map kept up to date with an image that is edited in place
+ *
+ * Exact FCU outputs only depend on their own band and the three cycles
+ * before them (see fcu_output_column()), never on the shift registers the
+ * previous band left behind. So after pixels change, each affected band
+ * restarts the trio from empty registers three cycles ahead of the first
+ * affected column and reruns only the cycles that produce the affected
+ * columns. The work of an update follows the size of the edit, not the image
+ */
+typedef struct {
+    int size;                   //width of the image in pixels
+    fcu_storage_t* pixels;      //size x size, owned by the caller
+    tensor_layout_s layout;     //exact shape of the map, fcu_output_layout()
+    fcu_storage_t* map;         //the persisted feature map
+    fcu_s* fcus[3];
+    long updates;               //edits applied since the initial full pass
+    long cycles_run;            //over every update, the initial full pass included
+} incremental_map_s;
+
+incremental_map_s* init_incremental_map(incremental_map_s* map, kernel_s* kernel, fcu_storage_t* pixels, int size);
+long update_incremental_map(incremental_map_s* map, const image_rect_s* dirty, image_rect_s* affected);
+void free_incremental_map(incremental_map_s* map);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "io.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//bit i set if byte i of the 64 at p is a delimiter, newlines also set in *newlines
+static uint64_t delimiter_mask(const char* p, uint64_t* newlines) {
+    uint64_t delims = 0;
+    uint64_t lines = 0;
+#if defined(__SSE2__)
+    //everything at or below ' ' is a delimiter, that covers tab, CR, LF and space
+    const __m128i limit = _mm_set1_epi8(0x21);
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+        uint64_t d = (uint16_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+        uint64_t n = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        delims |= d << (16 * k);
+        lines |= n << (16 * k);
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c <= ' ') delims |= (uint64_t)1 << i;
+        if (c == '\n') lines |= (uint64_t)1 << i;
+    }
+#endif
+    *newlines = lines;
+    return delims;
+}
+
+//move the unparsed tail to the front of the buffer and read the next block after it
+static void refill(pixel_reader_s* reader) {
+    size_t left = reader->length - reader->pos;
+    memmove(reader->buffer, reader->buffer + reader->pos, left);
+    reader->length = left + fread(reader->buffer + left, 1, PIXEL_READ_BLOCK, reader->file);
+    reader->pos = 0;
+    reader->eof = feof(reader->file) || ferror(reader->file);
+    reader->chunk = (size_t)-1;
+
+    //the masks read up to 64 bytes past the data, pad with delimiters
+    memset(reader->buffer + reader->length, ' ', 64);
+}
+
+/**
+ * Open a tab separated image for reading with read_pixels()
+ *
+ * @param filename Text image in the generate_shapes.py format
+ * @return The reader, exits if the file cannot be opened
+ */
+pixel_reader_s* open_pixel_reader(char* filename) {
+    pixel_reader_s* reader = (pixel_reader_s*)calloc(1, sizeof(pixel_reader_s));
+    if (reader == NULL) {
+        fprintf(stderr, "Memory allocation failed for pixel reader\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reader->file = fopen(filename, "r");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Could not open input file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    //room for a partial token carried over, one block and the delimiter padding
+    reader->buffer = (char*)malloc(PIXEL_MAX_TOKEN + PIXEL_READ_BLOCK + 64);
+    if (reader->buffer == NULL) {
+        fprintf(stderr, "Memory allocation failed for pixel reader buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reader->filename = filename;
+    reader->columns = -1;
+    refill(reader);
+    return reader;
+}
+
+//a newline ends the current row, blank lines are ignored
+static void end_row(pixel_reader_s* reader) {
+    if (reader->column == 0) return;
+    if (reader->columns < 0) {
+        reader->columns = reader->column;
+    } else if (reader->column != reader->columns) {
+        fprintf(stderr, "Input file %s: row %d has %d values, expected %d\n",
+                reader->filename, reader->rows + 1, reader->column, reader->columns);
+        exit(EXIT_FAILURE);
+    }
+    reader->rows++;
+    reader->column = 0;
+}
+
+/**
+ * Skip delimiters up to the next value, ending rows at newlines on the way
+ * Returns 0 at the end of the file
+ */
+static int next_token(pixel_reader_s* reader) {
+    //common case, a single tab and then the next value
+    if (reader->pos + PIXEL_MAX_TOKEN <= reader->length) {
+        const char* p = reader->buffer + reader->pos;
+        if (p[0] == '\t' && (unsigned char)p[1] > ' ') {
+            reader->pos++;
+            return 1;
+        }
+    }
+
+    while (1) {
+        if (reader->length - reader->pos < PIXEL_MAX_TOKEN && !reader->eof) refill(reader);
+        if (reader->pos >= reader->length) return 0;
+
+        //masks are cached per 64 byte chunk of the buffer
+        size_t chunk = reader->pos & ~(size_t)63;
+        if (chunk != reader->chunk) {
+            reader->delims = delimiter_mask(reader->buffer + chunk, &reader->newlines);
+            reader->chunk = chunk;
+        }
+
+        int offset = (int)(reader->pos - chunk);
+        uint64_t values = ~reader->delims >> offset;
+        uint64_t lines = reader->newlines >> offset;
+
+        if (values != 0) {
+            int skip = __builtin_ctzll(values);
+            if (lines & ((((uint64_t)1) << skip) - 1)) end_row(reader);
+            reader->pos += skip;
+            if (reader->pos < reader->length) return 1;
+        } else {
+            if (lines != 0) end_row(reader);
+            reader->pos = chunk + 64 < reader->length ? chunk + 64 : reader->length;
+        }
+    }
+}
+
+/**
+ * Convert the value at the read position by hand, no locale lookups
+ * Accepts an optional sign and decimal fraction
+ */
+static double parse_token_slow(pixel_reader_s* reader) {
+    const char* p = reader->buffer + reader->pos;
+    const char* start = p;
+    int negative = 0;
+    if (*p == '-' || *p == '+') negative = (*p++ == '-');
+
+    long whole = 0;
+    int digits = 0;
+    while ((unsigned)(*p - '0') < 10) {
+        whole = whole * 10 + (*p++ - '0');
+        digits++;
+    }
+
+    double value = (double)whole;
+    if (*p == '.') {
+        p++;
+        double scale = 0.1;
+        while ((unsigned)(*p - '0') < 10) {
+            value += (*p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+
+    if (digits == 0 || (unsigned char)*p > ' ' || p - start >= PIXEL_MAX_TOKEN) {
+        fprintf(stderr, "Input file %s: invalid value on row %d, column %d\n",
+                reader->filename, reader->rows + 1, reader->column + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    reader->pos += p - start;
+    reader->column++;
+    return negative ? -value : value;
+}
+
+/**
+ * Plain integers of up to 7 digits, which is every value generate_shapes.py
+ * writes, are converted 8 bytes at a time without branching on each digit.
+ * Anything else goes through parse_token_slow()
+ */
+static double parse_token(pixel_reader_s* reader) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    memcpy(&word, reader->buffer + reader->pos, sizeof(word));
+
+    //digits become 0..9, the high bit of the first byte that is not a digit gets set
+    uint64_t digits = word ^ 0x3030303030303030ULL;
+    uint64_t non_digits = ((digits + 0x7676767676767676ULL) | digits) & 0x8080808080808080ULL;
+    if (non_digits != 0) {
+        int length = __builtin_ctzll(non_digits) >> 3;
+        unsigned char end = (unsigned char)(word >> (8 * length));
+        if (length > 0 && end <= ' ') {
+            //first digit into the top used byte, then combine pairs, quads and halves
+            digits <<= 8 * (8 - length);
+            digits = (digits * 10 + (digits >> 8)) & 0x00FF00FF00FF00FFULL;
+            digits = (digits * 100 + (digits >> 16)) & 0x0000FFFF0000FFFFULL;
+            digits = (digits * 10000 + (digits >> 32)) & 0xFFFFFFFFULL;
+
+            reader->pos += length;
+            reader->column++;
+            return (double)digits;
+        }
+    }
+#endif
+    return parse_token_slow(reader);
+}
+
+/**
+ * Read the next count pixel values
+ *
+ * Values are read in file order, so calling this once per row block streams
+ * the image the same way init_pixel_inputs() reads it in one go. The file is
+ * read in PIXEL_READ_BLOCK chunks and scanned for delimiters 64 bytes at a
+ * time, then each value is converted without strtod and narrowed to the
+ * storage type
+ *
+ * @param reader Reader from open_pixel_reader()
+ * @param pixels Where to store the values
+ * @param count Number of values to read
+ * @return Number of values actually read
+ */
+int read_pixels(pixel_reader_s* reader, fcu_storage_t* pixels, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (!next_token(reader)) break;
+        pixels[i] = data_to_storage((fcu_data_t)parse_token(reader));
+    }
+    return i;
+}
+
+/**
+ * Check the rest of the file and close it
+ *
+ * The image must be exactly size rows of size values, anything else is
+ * reported with the actual shape and the run stops
+ *
+ * @param reader Reader from open_pixel_reader(), freed here
+ * @param size Requested image width
+ */
+void close_pixel_reader(pixel_reader_s* reader, int size) {
+    while (next_token(reader)) parse_token(reader);
+    end_row(reader);
+
+    if (reader->rows != size || reader->columns != size) {
+        fprintf(stderr, "Input file %s is %d x %d, expected %d x %d\n",
+                reader->filename, reader->rows, reader->columns < 0 ? 0 : reader->columns, size, size);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(reader->file);
+    free(reader->buffer);
+    free(reader);
+}
+
+/**
+ * Write feature map values in the output.txt format
+ *
+ * A newline starts every size values. start is the feature map index of
+ * values[0], which lets a feature map be written in several pieces
+ *
+ * @param file Open output file
+ * @param values Values to write
+ * @param count Number of values
+ * @param start Feature map index of the first value
+ * @param size Width of the feature map
+ */
+void write_feature_map_values(FILE* file, fcu_storage_t* values, int count, int start, int size) {
+    for (int i = 0; i < count; i++) {
+        if ((start + i) % size == 0) {
+            fprintf(file, "\n");
+        }
+        fprintf(file, "%.2f\t", (double)storage_to_data(values[i]));
+    }
+}
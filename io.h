@@ -0,0 +1,40 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "precision.h"
+
+//bytes read from the input file at a time
+#define PIXEL_READ_BLOCK (1 << 20)
+//longest value accepted in an input file
+#define PIXEL_MAX_TOKEN 64
+
+/**
+ * Buffered reader for the tab separated image format
+ *
+ * Tracks rows and columns as it goes so the image shape can be checked
+ * against the requested size
+ */
+typedef struct {
+    FILE* file;
+    char* filename;
+    char* buffer;
+    size_t length;          //bytes of file data in the buffer
+    size_t pos;             //next unparsed byte
+    int eof;
+    size_t chunk;           //buffer offset the cached masks belong to
+    uint64_t delims;
+    uint64_t newlines;
+    int rows;               //complete rows so far
+    int column;             //values read on the current row
+    int columns;            //values on the first row, -1 until it ends
+} pixel_reader_s;
+
+pixel_reader_s* open_pixel_reader(char* filename);
+int read_pixels(pixel_reader_s* reader, fcu_storage_t* pixels, int count);
+void close_pixel_reader(pixel_reader_s* reader, int size);
+void write_feature_map_values(FILE* file, fcu_storage_t* values, int count, int start, int size);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "lanes.h"
+#include "engine.h"
+
+/**
+ * Set up lanes trios, lane l filtering with kernels[l]
+ * The coefficients are copied, the kernels stay with the caller
+ */
+fcu_lanes_s* init_fcu_lanes(fcu_lanes_s* fcus, kernel_s** kernels, int lanes) {
+    if (lanes < 1 || lanes > FCU_MAX_LANES) {
+        fprintf(stderr, "FCU lanes must be between 1 and %d, got %d\n", FCU_MAX_LANES, lanes);
+        exit(EXIT_FAILURE);
+    }
+
+    fcus = (fcu_lanes_s*)malloc(sizeof(fcu_lanes_s));
+    //coefficients and both shift registers in one block, 18 + 9 + 9 values per lane
+    fcu_data_t* values = (fcu_data_t*)malloc(36 * lanes * sizeof(fcu_data_t));
+    if (fcus == NULL || values == NULL) {
+        fprintf(stderr, "Memory allocation failed for FCU lanes\n");
+        exit(EXIT_FAILURE);
+    }
+    fcus->lanes = lanes;
+    fcus->h = values;
+    fcus->shift_reg_1 = values + 18 * lanes;
+    fcus->shift_reg_2 = values + 27 * lanes;
+
+    for (int l = 0; l < lanes; l++) {
+        fcu_coefficients_s* rows[3] = { kernels[l]->kernel_row_1, kernels[l]->kernel_row_2, kernels[l]->kernel_row_3 };
+        for (int r = 0; r < 3; r++) {
+            fcu_data_t* h = fcus->h + r * 6 * lanes + l;
+            h[0 * lanes] = rows[r]->h_0;
+            h[1 * lanes] = rows[r]->h_1;
+            h[2 * lanes] = rows[r]->h_2;
+            h[3 * lanes] = rows[r]->h_01;
+            h[4 * lanes] = rows[r]->h_12;
+            h[5 * lanes] = rows[r]->h_012;
+        }
+    }
+
+    reset_fcu_lanes(fcus);
+    return fcus;
+}
+
+//same as reset_fcu_trio(), every lane starts from empty shift registers
+void reset_fcu_lanes(fcu_lanes_s* fcus) {
+    memset(fcus->shift_reg_1, 0, 18 * fcus->lanes * sizeof(fcu_data_t));
+    fcus->phase = 0;
+}
+
+void free_fcu_lanes(fcu_lanes_s* fcus) {
+    free(fcus->h);
+    free(fcus);
+}
+
+/**
+ * three_parallel_fcu() for lane l of one kernel row, the same signals in the
+ * same order so every lane matches the scalar trio bit for bit. The row's
+ * outputs start the trio sum for row 0 and are added to it after that
+ */
+static inline void lane_fcu(fcu_data_t x_0, fcu_data_t x_1, fcu_data_t x_2, const fcu_data_t* h, int n, int l,
+                            fcu_data_t* sr_1, fcu_data_t* sr_2, fcu_data_t y[3][FCU_MAX_LANES], int first_row) {
+    fcu_data_t a = x_0 * h[l];
+    fcu_data_t b = x_1 * h[n + l];
+    fcu_data_t c = x_2 * h[2 * n + l];
+    fcu_data_t d = x_0 + x_1;
+    fcu_data_t e = x_1 + x_2;
+    fcu_data_t f = d * h[3 * n + l];
+    fcu_data_t g = e * h[4 * n + l];
+    fcu_data_t s = d + x_2;             //h in the signal diagram
+    fcu_data_t j = a - sr_1[l];
+    sr_1[l] = c;
+    fcu_data_t m = s * h[5 * n + l];
+    fcu_data_t k = f - b;
+    fcu_data_t q = g - b;               //l in the signal diagram
+    fcu_data_t y_0 = j + sr_2[l];
+    sr_2[l] = q;
+    fcu_data_t y_1 = k - j;
+    fcu_data_t y_2 = (m - k) - q;
+
+    y[0][l] = first_row ? y_0 : y[0][l] + y_0;
+    y[1][l] = first_row ? y_1 : y[1][l] + y_1;
+    y[2][l] = first_row ? y_2 : y[2][l] + y_2;
+}
+
+/**
+ * Same as fcu_convolve_band() for a block of channels at once
+ *
+ * Every cycle each kernel row loads one channel vector per window pixel and
+ * runs all lanes of the FCU datapath on it. Outputs land in their columns by
+ * fcu_output_column(), lane l next to lane l - 1, which is the NCHW<N>c
+ * pixel order when stride is the block size. Multiplies are counted in bulk
+ * and the NaN check of multiplier() / adder() runs on the stored sums
+ *
+ * @param fcus The lanes, kernels already loaded
+ * @param in Pixels of the band's KERNEL_SIZE image rows
+ * @param width Width of the image in pixels
+ * @param out Lane 0 of column 0 of the band's output row
+ * @param stride Elements between output columns
+ * @param epilogue Applied to each finished entry, NULL to only add the outputs
+ * @param first_channel Output channel of lane 0, picks the epilogue biases
+ * @return Number of cycles run, each one cycle of every lane
+ */
+int fcu_convolve_band_lanes(fcu_lanes_s* fcus, const lane_inputs_s* in, int width, fcu_storage_t* out, int stride,
+                            const epilogue_s* epilogue, int first_channel) {
+    int n = fcus->lanes;
+    int last = width - KERNEL_SIZE;
+    int cycles = 0;
+    fcu_data_t y[3][FCU_MAX_LANES];
+    fcu_data_t bias[FCU_MAX_LANES];
+    for (int l = 0; l < n; l++) {
+        bias[l] = epilogue != NULL ? epilogue_bias(epilogue, first_channel + l) : 0.0;
+    }
+
+    for (int t = 0; t <= last; t += STRIDE) {
+        int slot = fcus->phase;
+        for (int r = 0; r < 3; r++) {
+            fcu_storage_t* x = in->rows + (size_t)r * in->row_stride + (size_t)t * in->col_stride;
+            const fcu_data_t* h = fcus->h + r * 6 * n;
+            fcu_data_t* sr_1 = fcus->shift_reg_1 + (r * 3 + slot) * n;
+            fcu_data_t* sr_2 = fcus->shift_reg_2 + (r * 3 + slot) * n;
+
+            if (in->lane_step) {
+                fcu_storage_t* x_1 = x + in->col_stride;
+                fcu_storage_t* x_2 = x + 2 * in->col_stride;
+                for (int l = 0; l < n; l++) {
+                    lane_fcu(storage_to_data(x[l]), storage_to_data(x_1[l]), storage_to_data(x_2[l]),
+                             h, n, l, sr_1, sr_2, y, r == 0);
+                }
+            } else {
+                //a grouped block whose lanes all read the same input channel
+                fcu_data_t x_0 = storage_to_data(x[0]);
+                fcu_data_t x_1 = storage_to_data(x[in->col_stride]);
+                fcu_data_t x_2 = storage_to_data(x[2 * in->col_stride]);
+                for (int l = 0; l < n; l++) {
+                    lane_fcu(x_0, x_1, x_2, h, n, l, sr_1, sr_2, y, r == 0);
+                }
+            }
+        }
+        fcus->phase = slot == 2 ? 0 : slot + 1;
+        //a, b, c, f, g and m in each of the three FCUs of every lane
+        multiply_count += 18ULL * n;
+
+        for (int k = 0; k < 3; k++) {
+            int col = fcu_output_column(t, last, k);
+            if (col < 0) continue;
+            fcu_storage_t* dst = out + (size_t)col * stride;
+            for (int l = 0; l < n; l++) {
+                fcu_data_t v = storage_to_data(dst[l]) + y[k][l];
+                if (isnan(v)) {
+                    fprintf(stderr, "FCU lane %d resulted in NaN\n", first_channel + l);
+                    exit(EXIT_FAILURE);
+                }
+                if (epilogue != NULL) v = apply_epilogue(epilogue, bias[l], v);
+                dst[l] = data_to_storage(v);
+            }
+        }
+        cycles++;
+    }
+
+    return cycles;
+}
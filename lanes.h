@@ -0,0 +1,44 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "fcu.h"
+#include "epilogue.h"
+
+//widest channel block the lanes run in lockstep
+#define FCU_MAX_LANES 64
+
+/**
+ * lanes FCU trios stepping together, one per channel of a channel block
+ *
+ * Lane l has its own kernel and its own shift registers but every lane is on
+ * the same cycle, so the datapath of three_parallel_fcu() runs as loops over
+ * the lanes that read one channel vector per pixel of an NCHW<N>c tensor.
+ * The shift registers are lanes wide delay lines of three slots, slot phase
+ * is read and then refilled each cycle
+ */
+typedef struct {
+    int lanes;
+    int phase;
+    fcu_data_t* h;              //[(row * 6 + tap) * lanes + lane], taps h_0 h_1 h_2 h_01 h_12 h_012
+    fcu_data_t* shift_reg_1;    //[(row * 3 + slot) * lanes + lane], delays x_2 h_2
+    fcu_data_t* shift_reg_2;    //[(row * 3 + slot) * lanes + lane], delays g - b
+} fcu_lanes_s;
+
+/**
+ * Where the lanes read a band's pixels: lane l of image row i, column j is
+ * rows[i * row_stride + j * col_stride + l * lane_step]
+ */
+typedef struct {
+    fcu_storage_t* rows;
+    int row_stride;
+    int col_stride;
+    int lane_step;      //1 for a channel per lane, 0 when every lane reads the same channel
+} lane_inputs_s;
+
+fcu_lanes_s* init_fcu_lanes(fcu_lanes_s* fcus, kernel_s** kernels, int lanes);
+void reset_fcu_lanes(fcu_lanes_s* fcus);
+void free_fcu_lanes(fcu_lanes_s* fcus);
+int fcu_convolve_band_lanes(fcu_lanes_s* fcus, const lane_inputs_s* in, int width, fcu_storage_t* out, int stride,
+                            const epilogue_s* epilogue, int first_channel);
+
+#endif
@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "layers.h"
+#include "engine.h"
+#include "lanes.h"
+#include "trace.h"
+
+/**
+ * Kernels handed out to the (output, input) channel pairs in turn
+ * Like init_kernel() these are fixed until kernels can be read from a file
+ */
+static const fcu_data_t KERNEL_BANK[][3][3] = {
+    { { 1, 0, -1 }, { 1, 0, -1 }, { 1, 0, -1 } },    //vertical edge
+    { { 1, 1, 1 }, { 0, 0, 0 }, { -1, -1, -1 } },    //horizontal edge
+    { { 0, -1, 0 }, { -1, 4, -1 }, { 0, -1, 0 } },   //laplacian
+    { { 1, 2, 1 }, { 2, 4, 2 }, { 1, 2, 1 } }        //gaussian, unnormalised
+};
+#define KERNEL_BANK_SIZE (int)(sizeof(KERNEL_BANK) / sizeof(KERNEL_BANK[0]))
+
+//reusable barrier, pthread_barrier_t is missing on macOS
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+    int waiting;
+    int generation;
+} layer_barrier_s;
+
+/**
+ * Output channels [first, first + lanes) of the grouped stage, run by one set
+ * of FCU lanes per input of the group. Lane l reads input channel
+ * input + l * lane_step of the current input
+ */
+typedef struct {
+    int first;
+    int lanes;
+    int lane_step;
+} layer_unit_s;
+
+typedef struct {
+    conv_layer_s* layer;
+    layer_unit_s* units;
+    int n_units;
+    fcu_lanes_s** fcus;             //[unit * (channels / groups) + input]
+    fcu_storage_t* input;
+    const tensor_layout_s* in_layout;
+    fcu_storage_t* output;
+    const tensor_layout_s* layout;
+    fcu_storage_t* block;           //depthwise output of the current band block
+    tensor_layout_s block_layout;   //block_bands rows, blocked like the output
+    int size;
+    int block_bands;
+    int n_threads;
+    const epilogue_s* epilogue;     //NULL for none
+    layer_barrier_s* barrier;
+} layer_run_s;
+
+typedef struct {
+    layer_run_s* run;
+    int id;
+    long fcu_cycles;
+    unsigned long long fcu_multiplies;
+    unsigned long long pointwise_multiplies;
+} layer_worker_s;
+
+static void barrier_wait(layer_barrier_s* barrier) {
+    TRACE_SCOPE("layer barrier");
+    pthread_mutex_lock(&barrier->lock);
+    int generation = barrier->generation;
+    if (++barrier->waiting == barrier->count) {
+        barrier->waiting = 0;
+        barrier->generation++;
+        pthread_cond_broadcast(&barrier->cond);
+    } else {
+        while (generation == barrier->generation) {
+            pthread_cond_wait(&barrier->cond, &barrier->lock);
+        }
+    }
+    pthread_mutex_unlock(&barrier->lock);
+}
+
+static kernel_s* init_kernel_values(const fcu_data_t values[3][3]) {
+    kernel_s* kernel = (kernel_s*)malloc(sizeof(kernel_s));
+    fcu_coefficients_s* rows = (fcu_coefficients_s*)malloc(3 * sizeof(fcu_coefficients_s));
+    if (kernel == NULL || rows == NULL) {
+        fprintf(stderr, "Memory allocation failed for layer kernel\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int r = 0; r < 3; r++) {
+        rows[r].h_0 = values[r][0];
+        rows[r].h_1 = values[r][1];
+        rows[r].h_2 = values[r][2];
+        rows[r].h_01 = rows[r].h_0 + rows[r].h_1;
+        rows[r].h_12 = rows[r].h_1 + rows[r].h_2;
+        rows[r].h_012 = rows[r].h_0 + rows[r].h_1 + rows[r].h_2;
+    }
+    kernel->kernel_row_1 = &rows[0];
+    kernel->kernel_row_2 = &rows[1];
+    kernel->kernel_row_3 = &rows[2];
+    return kernel;
+}
+
+int kernel_bank_size() {
+    return KERNEL_BANK_SIZE;
+}
+
+/**
+ * Kernel number index of the bank on its own, for users outside a layer
+ * Free with free_bank_kernel()
+ */
+kernel_s* init_bank_kernel(int index) {
+    return init_kernel_values(KERNEL_BANK[index % KERNEL_BANK_SIZE]);
+}
+
+void free_bank_kernel(kernel_s* kernel) {
+    //the three rows were allocated together
+    free(kernel->kernel_row_1);
+    free(kernel);
+}
+
+/**
+ * Set up a depthwise / grouped layer with an optional fused pointwise stage
+ *
+ * @param channels Input channels
+ * @param groups Number of groups, must divide channels
+ * @param pointwise Output channels of the fused 1x1 stage, 0 for none
+ */
+conv_layer_s* init_conv_layer(conv_layer_s* layer, int channels, int groups, int pointwise) {
+    if (groups < 1 || channels % groups != 0) {
+        fprintf(stderr, "Groups (%d) must divide the number of channels (%d)\n", groups, channels);
+        exit(EXIT_FAILURE);
+    }
+
+    layer = (conv_layer_s*)malloc(sizeof(conv_layer_s));
+    if (layer == NULL) {
+        fprintf(stderr, "Memory allocation failed for conv layer\n");
+        exit(EXIT_FAILURE);
+    }
+    layer->channels = channels;
+    layer->groups = groups;
+    layer->pointwise = pointwise;
+
+    int per_group = channels / groups;
+    layer->kernels = (kernel_s**)malloc(channels * per_group * sizeof(kernel_s*));
+    if (layer->kernels == NULL) {
+        fprintf(stderr, "Memory allocation failed for layer kernels\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int o = 0; o < channels; o++) {
+        for (int i = 0; i < per_group; i++) {
+            layer->kernels[o * per_group + i] = init_kernel_values(KERNEL_BANK[(o + i) % KERNEL_BANK_SIZE]);
+        }
+    }
+
+    layer->pointwise_weights = NULL;
+    if (pointwise > 0) {
+        layer->pointwise_weights = (fcu_data_t*)malloc(pointwise * channels * sizeof(fcu_data_t));
+        if (layer->pointwise_weights == NULL) {
+            fprintf(stderr, "Memory allocation failed for pointwise weights\n");
+            exit(EXIT_FAILURE);
+        }
+        //alternating +1 / -1 so every output channel mixes all inputs
+        for (int p = 0; p < pointwise; p++) {
+            for (int c = 0; c < channels; c++) {
+                layer->pointwise_weights[p * channels + c] = ((p + c) % 2 == 0) ? 1.0 : -1.0;
+            }
+        }
+    }
+
+    return layer;
+}
+
+/**
+ * Split the grouped stage into units of FCU lanes
+ *
+ * With a blocked layout a channel block is one unit when its lanes read a
+ * channel vector of the input (depthwise) or all read the same input channel
+ * (groups a multiple of the block wide). Any other grouping, and every
+ * channel of a dense layout, runs as a unit of one lane
+ */
+static int plan_layer_units(conv_layer_s* layer, int block, layer_unit_s* units) {
+    int per_group = layer->channels / layer->groups;
+    int vector = block > 1 && (per_group == 1 || per_group % block == 0);
+    int n = 0;
+
+    for (int o = 0; o < layer->channels; ) {
+        units[n].first = o;
+        units[n].lanes = 1;
+        units[n].lane_step = per_group == 1 ? 1 : 0;
+        if (vector) {
+            units[n].lanes = layer->channels - o < block ? layer->channels - o : block;
+        }
+        o += units[n].lanes;
+        n++;
+    }
+    return n;
+}
+
+//run the grouped stage for the units this worker owns over bands [b0, b1)
+static void grouped_bands(layer_worker_s* worker, int b0, int b1, fcu_storage_t* dst,
+                          const tensor_layout_s* dst_layout, int dst_band0, const epilogue_s* epilogue) {
+    layer_run_s* run = worker->run;
+    conv_layer_s* layer = run->layer;
+    const tensor_layout_s* in_layout = run->in_layout;
+    int per_group = layer->channels / layer->groups;
+
+    for (int u = worker->id; u < run->n_units; u += run->n_threads) {
+        layer_unit_s* unit = &run->units[u];
+        int first_input = (unit->first / per_group) * per_group;
+
+        for (int band = b0; band < b1; band++) {
+            fcu_storage_t* out = layout_row(dst_layout, dst, unit->first, band - dst_band0);
+            for (int i = 0; i < per_group; i++) {
+                //depthwise lanes start on their own channel, grouped lanes share input i
+                lane_inputs_s in;
+                in.rows = layout_row(in_layout, run->input, per_group == 1 ? unit->first : first_input + i,
+                                     band * KERNEL_SIZE);
+                in.row_stride = in_layout->cols * in_layout->block;
+                in.col_stride = in_layout->block;
+                in.lane_step = unit->lane_step;
+
+                //the last input channel completes the entries, so it runs the epilogue
+                const epilogue_s* stage = i == per_group - 1 ? epilogue : NULL;
+                int cycles = fcu_convolve_band_lanes(run->fcus[u * per_group + i], &in, run->size, out,
+                                                     dst_layout->block, stage, unit->first);
+                //counted per trio, the same for every layout
+                worker->fcu_cycles += (long)cycles * unit->lanes;
+            }
+        }
+    }
+}
+
+//zero rows [0, rows) of a unit's channels before its bands are summed into them
+static void zero_unit_rows(const tensor_layout_s* layout, fcu_storage_t* base, layer_unit_s* unit, int rows) {
+    for (int c = unit->first; c < unit->first + unit->lanes; c++) {
+        for (int r = 0; r < rows; r++) {
+            fcu_storage_t* row = layout_row(layout, base, c, r);
+            for (int j = 0; j < layout->cols; j++) row[j * layout->block] = data_to_storage(0.0);
+        }
+    }
+}
+
+static void* layer_worker(void* arg) {
+    layer_worker_s* worker = (layer_worker_s*)arg;
+    layer_run_s* run = worker->run;
+    conv_layer_s* layer = run->layer;
+    int bands = run->layout->rows;
+    int cols = run->layout->cols;
+    int block = run->layout->block;
+    int out_blocks = (layer->pointwise + block - 1) / block;
+
+    multiply_count = 0;
+    trace_thread_name("layer worker");
+
+    if (layer->pointwise == 0) {
+        //no second stage, FCU outputs go straight into the output tensor
+        TRACE_SCOPE("grouped layer");
+        grouped_bands(worker, 0, bands, run->output, run->layout, 0, run->epilogue);
+        worker->fcu_multiplies = multiply_count;
+        return NULL;
+    }
+
+    for (int b0 = 0; b0 < bands; b0 += run->block_bands) {
+        int b1 = b0 + run->block_bands < bands ? b0 + run->block_bands : bands;
+
+        for (int u = worker->id; u < run->n_units; u += run->n_threads) {
+            zero_unit_rows(&run->block_layout, run->block, &run->units[u], b1 - b0);
+        }
+
+        trace_scope_s scope = trace_begin("grouped block");
+        unsigned long long start = multiply_count;
+        grouped_bands(worker, b0, b1, run->block, &run->block_layout, b0, NULL);
+        worker->fcu_multiplies += multiply_count - start;
+        trace_end(&scope);
+
+        //every channel of the block has to be done before it can be mixed
+        barrier_wait(run->barrier);
+
+        scope = trace_begin("pointwise block");
+        start = multiply_count;
+        //whole output blocks per worker, so no two workers write the same pixel vector
+        for (int pb = worker->id; pb < out_blocks; pb += run->n_threads) {
+            for (int p = pb * block; p < (pb + 1) * block && p < layer->pointwise; p++) {
+                fcu_data_t* weights = layer->pointwise_weights + p * layer->channels;
+                fcu_data_t bias = run->epilogue != NULL ? epilogue_bias(run->epilogue, p) : 0.0;
+
+                for (int r = 0; r < b1 - b0; r++) {
+                    fcu_storage_t* out = layout_row(run->layout, run->output, p, b0 + r);
+                    for (int j = 0; j < cols; j++) {
+                        fcu_data_t acc = 0.0;
+                        for (int c = 0; c < layer->channels; c++) {
+                            fcu_storage_t* in = layout_row(&run->block_layout, run->block, c, r);
+                            acc = adder(acc, multiplier(weights[c], storage_to_data(in[j * block])));
+                        }
+                        if (run->epilogue != NULL) acc = apply_epilogue(run->epilogue, bias, acc);
+                        out[j * block] = data_to_storage(acc);
+                    }
+                }
+            }
+        }
+        worker->pointwise_multiplies += multiply_count - start;
+        trace_end(&scope);
+
+        //the block buffer is reused for the next bands
+        barrier_wait(run->barrier);
+    }
+
+    return NULL;
+}
+
+/**
+ * Run the layer over a multi-channel image
+ *
+ * Output channels are dealt out round robin to n_threads workers, a channel
+ * block at a time when the layout is blocked, each driving the FCU lanes of
+ * its channels. With a pointwise stage the bands are processed in blocks small
+ * enough to stay in cache: all workers fill the depthwise block, then mix it
+ * into the pointwise outputs before moving on
+ *
+ * The input and output should share the channel block, otherwise the lanes
+ * fall back to one channel each
+ *
+ * @param layer Layer from init_conv_layer()
+ * @param input Input channels, each a square image
+ * @param in_layout Shape and channel blocking of input
+ * @param output Zeroed output tensor, channels or pointwise channels of the
+ *               fcu_output_layout() shape
+ * @param layout Shape and channel blocking of output
+ * @param n_threads Worker threads to use
+ * @param epilogue Applied to the final outputs of the layer, NULL for none
+ * @param stats Cycle and multiply totals of all workers
+ */
+void run_conv_layer(conv_layer_s* layer, fcu_storage_t* input, const tensor_layout_s* in_layout, fcu_storage_t* output,
+                    const tensor_layout_s* layout, int n_threads, const epilogue_s* epilogue, layer_stats_s* stats) {
+    int per_group = layer->channels / layer->groups;
+
+    layer_run_s run;
+    memset(&run, 0, sizeof(layer_run_s));
+    run.layer = layer;
+    run.input = input;
+    run.in_layout = in_layout;
+    run.output = output;
+    run.layout = layout;
+    run.size = in_layout->cols;
+    run.epilogue = epilogue;
+
+    run.units = (layer_unit_s*)malloc(layer->channels * sizeof(layer_unit_s));
+    if (run.units == NULL) {
+        fprintf(stderr, "Memory allocation failed for layer units\n");
+        exit(EXIT_FAILURE);
+    }
+    run.n_units = plan_layer_units(layer, in_layout->block == layout->block ? layout->block : 1, run.units);
+
+    run.fcus = (fcu_lanes_s**)malloc(run.n_units * per_group * sizeof(fcu_lanes_s*));
+    if (run.fcus == NULL) {
+        fprintf(stderr, "Memory allocation failed for layer FCUs\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int u = 0; u < run.n_units; u++) {
+        for (int i = 0; i < per_group; i++) {
+            kernel_s* kernels[FCU_MAX_LANES];
+            for (int l = 0; l < run.units[u].lanes; l++) {
+                kernels[l] = layer->kernels[(run.units[u].first + l) * per_group + i];
+            }
+            run.fcus[u * per_group + i] = init_fcu_lanes(NULL, kernels, run.units[u].lanes);
+        }
+    }
+
+    int out_blocks = (layer->pointwise + layout->block - 1) / layout->block;
+    int max_threads = run.n_units > out_blocks ? run.n_units : out_blocks;
+    if (n_threads > max_threads) n_threads = max_threads;
+    if (n_threads < 1) n_threads = 1;
+    run.n_threads = n_threads;
+
+    layer_barrier_s barrier;
+    pthread_mutex_init(&barrier.lock, NULL);
+    pthread_cond_init(&barrier.cond, NULL);
+    barrier.count = n_threads;
+    barrier.waiting = 0;
+    barrier.generation = 0;
+    run.barrier = &barrier;
+
+    if (layer->pointwise > 0) {
+        int bands = layout->rows;
+        run.block_bands = LAYER_BLOCK_BYTES / (layer->channels * layout->cols * (int)sizeof(fcu_storage_t));
+        if (run.block_bands < 1) run.block_bands = 1;
+        if (run.block_bands > bands) run.block_bands = bands;
+
+        //blocked like the output, so the 1x1 stage reads one channel vector per pixel
+        run.block_layout = make_tensor_layout(run.block_bands, layout->cols, layer->channels, layout->block);
+        run.block = alloc_layout(&run.block_layout);
+    }
+
+    layer_worker_s* workers = (layer_worker_s*)calloc(n_threads, sizeof(layer_worker_s));
+    pthread_t* threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed for layer workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        workers[t].run = &run;
+        workers[t].id = t;
+        if (pthread_create(&threads[t], NULL, layer_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Could not start layer worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(stats, 0, sizeof(layer_stats_s));
+    for (int t = 0; t < n_threads; t++) {
+        pthread_join(threads[t], NULL);
+        stats->fcu_cycles += workers[t].fcu_cycles;
+        stats->fcu_multiplies += workers[t].fcu_multiplies;
+        stats->pointwise_multiplies += workers[t].pointwise_multiplies;
+    }
+
+    free(run.block);
+    for (int p = 0; p < run.n_units * per_group; p++) free_fcu_lanes(run.fcus[p]);
+    free(run.fcus);
+    free(run.units);
+    free(workers);
+    free(threads);
+    pthread_mutex_destroy(&barrier.lock);
+    pthread_cond_destroy(&barrier.cond);
+}
+
+void free_conv_layer(conv_layer_s* layer) {
+    int pairs = layer->channels * (layer->channels / layer->groups);
+    for (int p = 0; p < pairs; p++) {
+        //the three rows were allocated together
+        free(layer->kernels[p]->kernel_row_1);
+        free(layer->kernels[p]);
+    }
+    free(layer->kernels);
+    free(layer->pointwise_weights);
+    free(layer);
+}
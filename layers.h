@@ -0,0 +1,41 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include "fcu.h"
+#include "epilogue.h"
+#include "layout.h"
+
+//depthwise output held between the two fused stages, sized to stay in L2
+#define LAYER_BLOCK_BYTES (256 * 1024)
+
+/**
+ * A multi-channel 3x3 convolution layer built from FCU trios
+ *
+ * Output channel o reads the channels / groups input channels of its group
+ * and each (output, input) pair has its own kernel and its own FCU trio.
+ * groups == channels is a depthwise convolution. With pointwise > 0 a 1x1
+ * convolution to pointwise channels is fused behind it
+ */
+typedef struct {
+    int channels;                   //input channels, also the grouped output channels
+    int groups;
+    int pointwise;                  //output channels of the fused 1x1 stage, 0 for none
+    kernel_s** kernels;             //[out * (channels / groups) + in]
+    fcu_data_t* pointwise_weights;  //[p * channels + c]
+} conv_layer_s;
+
+typedef struct {
+    long fcu_cycles;
+    unsigned long long fcu_multiplies;
+    unsigned long long pointwise_multiplies;
+} layer_stats_s;
+
+int kernel_bank_size();
+kernel_s* init_bank_kernel(int index);
+void free_bank_kernel(kernel_s* kernel);
+conv_layer_s* init_conv_layer(conv_layer_s* layer, int channels, int groups, int pointwise);
+void run_conv_layer(conv_layer_s* layer, fcu_storage_t* input, const tensor_layout_s* in_layout, fcu_storage_t* output,
+                    const tensor_layout_s* layout, int n_threads, const epilogue_s* epilogue, layer_stats_s* stats);
+void free_conv_layer(conv_layer_s* layer);
+
+#endif
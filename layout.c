@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "layout.h"
+
+tensor_layout_s make_tensor_layout(int rows, int cols, int channels, int block) {
+    tensor_layout_s layout;
+    layout.rows = rows;
+    layout.cols = cols;
+    layout.channels = channels;
+    layout.block = block < 1 ? 1 : block;
+    return layout;
+}
+
+/**
+ * Exact output shape of the FCU engine, (W - F + 2P) / S + 1 on each axis
+ *
+ * The trio slides STRIDE columns per cycle and steps down the image a band of
+ * KERNEL_SIZE rows at a time, so output row r comes from band r and output
+ * column j from the window starting at column j. An image smaller than the
+ * kernel has no output
+ *
+ * @param size Width and height of the image, padding not included
+ * @param padding Zero rows and columns added on each side
+ * @param channels Output channels
+ * @param block Channels per block, 1 for dense planes
+ */
+tensor_layout_s fcu_output_layout(int size, int padding, int channels, int block) {
+    int span = size - KERNEL_SIZE + 2 * padding;
+    if (span < 0) return make_tensor_layout(0, 0, channels, block);
+    return make_tensor_layout(span / KERNEL_SIZE + 1, span / STRIDE + 1, channels, block);
+}
+
+/**
+ * Zeroed tensor of the layout, aligned to LAYOUT_ALIGN so every channel
+ * block of 8 or 16 starts on a vector boundary. Release with free()
+ */
+fcu_storage_t* alloc_layout(const tensor_layout_s* layout) {
+    size_t bytes = layout_entries(layout) * sizeof(fcu_storage_t);
+    bytes = (bytes + LAYOUT_ALIGN - 1) / LAYOUT_ALIGN * LAYOUT_ALIGN;
+    fcu_storage_t* values = (fcu_storage_t*)aligned_alloc(LAYOUT_ALIGN, bytes > 0 ? bytes : LAYOUT_ALIGN);
+    if (values == NULL) {
+        fprintf(stderr, "Memory allocation failed for tensor\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(values, 0, bytes);
+    return values;
+}
+
+/**
+ * Copy a dense rows x cols plane, as loaded from a text image, into one
+ * channel of the tensor
+ */
+void pack_layout_channel(const tensor_layout_s* layout, fcu_storage_t* values, int channel, const fcu_storage_t* plane) {
+    for (int r = 0; r < layout->rows; r++) {
+        fcu_storage_t* row = layout_row(layout, values, channel, r);
+        const fcu_storage_t* src = plane + (size_t)r * layout->cols;
+        for (int j = 0; j < layout->cols; j++) {
+            row[j * layout->block] = src[j];
+        }
+    }
+}
+
+/**
+ * Write one channel in the output.txt format, a line per row
+ * Blocked maps are gathered here, so files look the same for every layout
+ */
+void write_layout_channel(FILE* file, const tensor_layout_s* layout, fcu_storage_t* values, int channel) {
+    for (int r = 0; r < layout->rows; r++) {
+        fcu_storage_t* row = layout_row(layout, values, channel, r);
+        fprintf(file, "\n");
+        for (int j = 0; j < layout->cols; j++) {
+            fprintf(file, "%.2f\t", (double)storage_to_data(row[j * layout->block]));
+        }
+    }
+}
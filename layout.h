@@ -0,0 +1,51 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "fcu.h"
+
+//alignment of tensors from alloc_layout(), a cache line and the widest vector
+#define LAYOUT_ALIGN 64
+
+/**
+ * Shape and storage order of an image or feature map tensor
+ *
+ * block == 1 keeps one dense row-major plane per channel (NCHW). block > 1
+ * packs block channels next to each other for every pixel (NCHW<block>c),
+ * the last group padded with unused channels, so a vectorised consumer can
+ * load one channel vector per pixel without reshuffling the map. Text files
+ * are always one plane per channel, the converters below sit at that boundary
+ */
+typedef struct {
+    int channels;
+    int rows;
+    int cols;
+    int block;
+} tensor_layout_s;
+
+/**
+ * Number of elements to allocate, including the padding channels of the
+ * last block
+ */
+static inline size_t layout_entries(const tensor_layout_s* layout) {
+    size_t groups = (layout->channels + layout->block - 1) / layout->block;
+    return groups * layout->block * layout->rows * layout->cols;
+}
+
+/**
+ * Column 0 of one row of one channel, column j is at row[j * layout->block]
+ */
+static inline fcu_storage_t* layout_row(const tensor_layout_s* layout, fcu_storage_t* base, int channel, int row) {
+    size_t pixel = ((size_t)(channel / layout->block) * layout->rows + row) * layout->cols;
+    return base + pixel * layout->block + channel % layout->block;
+}
+
+tensor_layout_s make_tensor_layout(int rows, int cols, int channels, int block);
+tensor_layout_s fcu_output_layout(int size, int padding, int channels, int block);
+fcu_storage_t* alloc_layout(const tensor_layout_s* layout);
+void pack_layout_channel(const tensor_layout_s* layout, fcu_storage_t* values, int channel, const fcu_storage_t* plane);
+void write_layout_channel(FILE* file, const tensor_layout_s* layout, fcu_storage_t* values, int channel);
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "pipeline.h"
+#include "trace.h"
+#include "engine.h"
+#include "io.h"
+#include "layout.h"
+
+/**
+ * Three stage load / compute / store pipeline
+ *
+ * The reader thread parses input files one band at a time, the calling thread
+ * runs the FCU trio on each band and the writer thread formats the feature map
+ * slices to disk. Stages hand row blocks to each other through bounded lock-free
+ * queues, so parsing band n+1 and writing band n-1 overlap computing band n,
+ * and for multi-image runs the next file is being read while the current one
+ * is still in the FCUs
+ */
+
+typedef struct {
+    block_queue_s free_blocks;  //writer -> reader
+    block_queue_s loaded;       //reader -> compute
+    block_queue_s computed;     //compute -> writer
+    char** input_files;
+    char** output_files;
+    int n_images;
+    int size;
+    tensor_layout_s layout;
+    pipeline_stats_s* stats;
+} pipeline_s;
+
+//spin until there is room, then publish the block to the consumer
+static void push_block(block_queue_s* queue, row_block_s* block) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == PIPELINE_DEPTH) {
+        sched_yield();
+    }
+    queue->slots[tail % PIPELINE_DEPTH] = block;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+//spin until the producer has published a block, then take it
+static row_block_s* pop_block(block_queue_s* queue) {
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while (atomic_load_explicit(&queue->tail, memory_order_acquire) == head) {
+        sched_yield();
+    }
+    row_block_s* block = queue->slots[head % PIPELINE_DEPTH];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return block;
+}
+
+static void* reader_stage(void* arg) {
+    pipeline_s* p = (pipeline_s*)arg;
+    int n_bands = p->size / KERNEL_SIZE;
+    int band_values = KERNEL_SIZE * p->size;
+    trace_thread_name("reader");
+
+    for (int img = 0; img < p->n_images; img++) {
+        double start = now_seconds();
+        pixel_reader_s* reader = open_pixel_reader(p->input_files[img]);
+        p->stats->reader_seconds += now_seconds() - start;
+
+        for (int band = 0; band < n_bands; band++) {
+            row_block_s* block = pop_block(&p->free_blocks);
+
+            trace_scope_s scope = trace_begin("pipeline read band");
+            start = now_seconds();
+            block->image = img;
+            block->band = band;
+            block->last = (band == n_bands - 1);
+            int read = read_pixels(reader, block->rows, band_values);
+            memset(block->rows + read, 0, (band_values - read) * sizeof(fcu_storage_t));
+            p->stats->reader_seconds += now_seconds() - start;
+            trace_end(&scope);
+
+            push_block(&p->loaded, block);
+        }
+
+        //rows left over after the last full band are only checked
+        start = now_seconds();
+        close_pixel_reader(reader, p->size);
+        p->stats->reader_seconds += now_seconds() - start;
+    }
+
+    row_block_s* end = pop_block(&p->free_blocks);
+    end->image = -1;
+    push_block(&p->loaded, end);
+    return NULL;
+}
+
+static void* writer_stage(void* arg) {
+    pipeline_s* p = (pipeline_s*)arg;
+    int cols = p->layout.cols;
+    FILE* file = NULL;
+    trace_thread_name("writer");
+
+    while (1) {
+        row_block_s* block = pop_block(&p->computed);
+        if (block->image < 0) break;
+
+        trace_scope_s scope = trace_begin("pipeline write band");
+        double start = now_seconds();
+        if (block->band == 0) {
+            file = fopen(p->output_files[block->image], "w");
+            if (file == NULL) {
+                fprintf(stderr, "Could not create output file %s\n", p->output_files[block->image]);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        //every band is one row of the feature map
+        write_feature_map_values(file, block->out, cols, block->band * cols, cols);
+
+        if (block->last) {
+            fclose(file);
+            file = NULL;
+        }
+        p->stats->writer_seconds += now_seconds() - start;
+        trace_end(&scope);
+
+        push_block(&p->free_blocks, block);
+    }
+    return NULL;
+}
+
+/**
+ * Convolve a list of images through the three stage pipeline
+ *
+ * @param fcus The FCU trio, kernel rows already assigned
+ * @param input_files Text images to read
+ * @param output_files Feature map file for each image
+ * @param n_images Number of images
+ * @param size Width of every image
+ * @param stats Filled with per-stage busy time and totals
+ */
+void run_pipeline(fcu_s** fcus, char** input_files, char** output_files, int n_images,
+                  int size, pipeline_stats_s* stats) {
+    pipeline_s p;
+    memset(&p, 0, sizeof(pipeline_s));
+    memset(stats, 0, sizeof(pipeline_stats_s));
+    p.input_files = input_files;
+    p.output_files = output_files;
+    p.n_images = n_images;
+    p.size = size;
+    p.layout = fcu_output_layout(size, 0, 1, 1);
+    p.stats = stats;
+
+    row_block_s blocks[PIPELINE_DEPTH];
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        blocks[i].rows = (fcu_storage_t*)malloc(KERNEL_SIZE * size * sizeof(fcu_storage_t));
+        blocks[i].out = (fcu_storage_t*)malloc(p.layout.cols * sizeof(fcu_storage_t));
+        if (blocks[i].rows == NULL || blocks[i].out == NULL) {
+            fprintf(stderr, "Memory allocation failed for pipeline row blocks\n");
+            exit(EXIT_FAILURE);
+        }
+        push_block(&p.free_blocks, &blocks[i]);
+    }
+
+    double wall_start = now_seconds();
+
+    pthread_t reader;
+    pthread_t writer;
+    if (pthread_create(&reader, NULL, reader_stage, &p) != 0 ||
+        pthread_create(&writer, NULL, writer_stage, &p) != 0) {
+        fprintf(stderr, "Could not start pipeline threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //compute stage runs on the calling thread
+    while (1) {
+        row_block_s* block = pop_block(&p.loaded);
+        if (block->image < 0) {
+            push_block(&p.computed, block);
+            break;
+        }
+
+        trace_scope_s scope = trace_begin("pipeline compute band");
+        double start = now_seconds();
+        //every image starts with empty shift registers, same as a fresh run
+        if (block->band == 0) reset_fcu_trio(fcus);
+        memset(block->out, 0, p.layout.cols * sizeof(fcu_storage_t));
+        stats->cycles += fcu_convolve_band(fcus, block->rows, size, block->out, 1,
+                                           block->band * p.layout.cols, NULL);
+        stats->blocks++;
+        stats->compute_seconds += now_seconds() - start;
+        trace_end(&scope);
+
+        push_block(&p.computed, block);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    stats->wall_seconds = now_seconds() - wall_start;
+
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        free(blocks[i].rows);
+        free(blocks[i].out);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdatomic.h>
+
+#include "fcu.h"
+
+//row blocks in flight, enough for the reader and writer to each work on one
+//block while compute works on another with one spare (double buffering)
+#define PIPELINE_DEPTH 4
+
+/**
+ * One band of KERNEL_SIZE image rows and the feature map slice it produces
+ * Blocks cycle reader -> compute -> writer -> reader
+ */
+typedef struct {
+    int image;      //index of the image, -1 marks the end of the stream
+    int band;       //band number within the image
+    int last;       //set on the last band of an image
+    fcu_storage_t* rows;   //KERNEL_SIZE * size input pixels
+    fcu_storage_t* out;    //one feature map row
+} row_block_s;
+
+/**
+ * Bounded single-producer single-consumer ring of row blocks
+ * head is only written by the consumer and tail only by the producer
+ */
+typedef struct {
+    row_block_s* slots[PIPELINE_DEPTH];
+    atomic_ulong head;
+    atomic_ulong tail;
+} block_queue_s;
+
+typedef struct {
+    double reader_seconds;   //time spent opening and parsing input files
+    double compute_seconds;  //time spent in the FCUs
+    double writer_seconds;   //time spent formatting and writing outputs
+    double wall_seconds;
+    long cycles;
+    long blocks;
+} pipeline_stats_s;
+
+void run_pipeline(fcu_s** fcus, char** input_files, char** output_files, int n_images,
+                  int size, pipeline_stats_s* stats);
+
+#endif
@@ -0,0 +1,429 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "pool.h"
+#include "engine.h"
+#include "trace.h"
+
+//pages are placed per slice, a slice smaller than this would share them
+#define POOL_PAGE_BYTES 4096
+
+typedef struct {
+    int cpus[POOL_MAX_WORKERS];
+    int nodes[POOL_MAX_WORKERS];
+    int n_cpus;
+    int n_nodes;
+} pool_topology_s;
+
+typedef struct {
+    char* base;
+    size_t bytes;
+    long n_tasks;
+} pool_touch_s;
+
+//one per worker, a cache line each so the counters are not shared
+typedef struct {
+    _Alignas(LAYOUT_ALIGN) fcu_s* trio[3];
+    long cycles;
+    long skipped;
+    unsigned long long multiplies;
+} pool_conv_worker_s;
+
+typedef struct {
+    kernel_s* kernel;
+    fcu_storage_t* pixels;
+    int size;
+    fcu_storage_t* out;
+    const tensor_layout_s* layout;
+    pool_conv_worker_s* workers;
+} pool_conv_s;
+
+#if defined(__linux__)
+/**
+ * Parse a sysfs CPU list such as "0-3,8-11" and mark node for each CPU in it
+ * that is also in allowed
+ */
+static void read_node_cpus(const char* path, int node, cpu_set_t* allowed, pool_topology_s* topology) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return;
+
+    int first, last;
+    char sep;
+    while (fscanf(file, "%d", &first) == 1) {
+        last = first;
+        if (fscanf(file, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(file, "%d", &last) != 1) break;
+            if (fscanf(file, "%c", &sep) != 1) sep = '\n';
+        }
+        for (int cpu = first; cpu <= last && topology->n_cpus < POOL_MAX_WORKERS; cpu++) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, allowed)) continue;
+            CPU_CLR(cpu, allowed);
+            topology->cpus[topology->n_cpus] = cpu;
+            topology->nodes[topology->n_cpus] = node;
+            topology->n_cpus++;
+        }
+        if (sep != ',') break;
+    }
+    fclose(file);
+}
+#endif
+
+/**
+ * The CPUs this process may run on, node by node. Without NUMA information
+ * every CPU is on node 0, without affinity support the list is empty
+ */
+static void read_topology(pool_topology_s* topology) {
+    memset(topology, 0, sizeof(pool_topology_s));
+    topology->n_nodes = 1;
+
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) return;
+
+    int nodes = 0;
+    for (int node = 0; node < POOL_MAX_NODES; node++) {
+        char path[64];
+        int before = topology->n_cpus;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        read_node_cpus(path, nodes, &allowed, topology);
+        if (topology->n_cpus > before) nodes++;
+    }
+
+    //CPUs no node listed, e.g. without sysfs, go on the last node
+    int last_node = nodes > 0 ? nodes - 1 : 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && topology->n_cpus < POOL_MAX_WORKERS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        topology->cpus[topology->n_cpus] = cpu;
+        topology->nodes[topology->n_cpus] = last_node;
+        topology->n_cpus++;
+    }
+    topology->n_nodes = nodes > 0 ? nodes : 1;
+#endif
+}
+
+static void pin_worker(pool_worker_s* worker) {
+#if defined(__linux__)
+    if (worker->cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    //a failed pin leaves the worker running unpinned, which is still correct
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) worker->cpu = -1;
+#else
+    worker->cpu = -1;
+#endif
+}
+
+//next task for this worker, stealing the back half of another deque once its own is empty
+static long next_task(thread_pool_s* pool, pool_worker_s* worker, int steal) {
+    pool_deque_s* own = &pool->deques[worker->id];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        long task = own->head++;
+        pthread_mutex_unlock(&own->lock);
+        return task;
+    }
+    pthread_mutex_unlock(&own->lock);
+    if (!steal) return -1;
+
+    //nearest ids first, they are on the same node
+    for (int i = 1; i < pool->n_workers; i++) {
+        int victim_id = (i % 2) ? worker->id + (i + 1) / 2 : worker->id - i / 2;
+        victim_id = (victim_id % pool->n_workers + pool->n_workers) % pool->n_workers;
+        pool_deque_s* victim = &pool->deques[victim_id];
+
+        pthread_mutex_lock(&victim->lock);
+        long left = victim->tail - victim->head;
+        if (left < 1) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        long take = (left + 1) / 2;
+        long first = victim->tail - take;
+        victim->tail = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        worker->steals++;
+        pthread_mutex_lock(&own->lock);
+        own->head = first + 1;
+        own->tail = first + take;
+        pthread_mutex_unlock(&own->lock);
+        return first;
+    }
+    return -1;
+}
+
+static void* pool_worker(void* arg) {
+    pool_worker_s* worker = (pool_worker_s*)arg;
+    thread_pool_s* pool = worker->pool;
+    int seen = 0;
+
+    pin_worker(worker);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pool_task_t task = pool->task;
+        void* task_arg = pool->arg;
+        int steal = pool->steal;
+        pthread_mutex_unlock(&pool->lock);
+
+        for (long t = next_task(pool, worker, steal); t >= 0; t = next_task(pool, worker, steal)) {
+            task(task_arg, t, worker->id);
+            worker->tasks++;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * Start n_workers workers, pinned to one CPU each when pin is set
+ *
+ * Workers beyond the CPUs the process may use share CPUs round robin
+ *
+ * @param pool Set up here
+ * @param n_workers Number of workers, 1 to POOL_MAX_WORKERS
+ * @param pin Pin each worker to its CPU
+ * @return The pool
+ */
+thread_pool_s* init_thread_pool(thread_pool_s* pool, int n_workers, int pin) {
+    if (n_workers < 1 || n_workers > POOL_MAX_WORKERS) {
+        fprintf(stderr, "Thread pool workers must be between 1 and %d, got %d\n", POOL_MAX_WORKERS, n_workers);
+        exit(EXIT_FAILURE);
+    }
+
+    pool = (thread_pool_s*)malloc(sizeof(thread_pool_s));
+    if (pool == NULL) {
+        fprintf(stderr, "Memory allocation failed for thread pool\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(pool, 0, sizeof(thread_pool_s));
+    pool->workers = (pool_worker_s*)calloc(n_workers, sizeof(pool_worker_s));
+    pool->deques = (pool_deque_s*)calloc(n_workers, sizeof(pool_deque_s));
+    if (pool->workers == NULL || pool->deques == NULL) {
+        fprintf(stderr, "Memory allocation failed for thread pool workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool_topology_s topology;
+    read_topology(&topology);
+    pool->n_workers = n_workers;
+    pool->pinned = pin && topology.n_cpus > 0;
+    pool->n_nodes = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    int highest_node = 0;
+    for (int w = 0; w < n_workers; w++) {
+        pool_worker_s* worker = &pool->workers[w];
+        worker->pool = pool;
+        worker->id = w;
+        worker->cpu = pool->pinned ? topology.cpus[w % topology.n_cpus] : -1;
+        worker->node = pool->pinned ? topology.nodes[w % topology.n_cpus] : 0;
+        if (worker->node > highest_node) highest_node = worker->node;
+        pthread_mutex_init(&pool->deques[w].lock, NULL);
+    }
+    pool->n_nodes = highest_node + 1;
+
+    for (int w = 0; w < n_workers; w++) {
+        if (pthread_create(&pool->workers[w].thread, NULL, pool_worker, &pool->workers[w]) != 0) {
+            fprintf(stderr, "Could not start pool worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+/**
+ * Run tasks 0 to n_tasks - 1 on the workers and wait until all are done
+ *
+ * @param pool The pool
+ * @param task Called once per task
+ * @param arg Passed to every call of task
+ * @param n_tasks Number of tasks
+ * @param steal Let idle workers take tasks from busy ones, off to keep every
+ *              task on the worker the initial split gives it
+ */
+void pool_run(thread_pool_s* pool, pool_task_t task, void* arg, long n_tasks, int steal) {
+    if (n_tasks < 1) return;
+
+    for (int w = 0; w < pool->n_workers; w++) {
+        pool->deques[w].head = n_tasks * w / pool->n_workers;
+        pool->deques[w].tail = n_tasks * (w + 1) / pool->n_workers;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->steal = steal;
+    pool->busy = pool->n_workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void touch_task(void* arg, long task, int worker) {
+    pool_touch_s* touch = (pool_touch_s*)arg;
+    (void)worker;
+    size_t first = touch->bytes * task / touch->n_tasks;
+    size_t end = touch->bytes * (task + 1) / touch->n_tasks;
+    memset(touch->base + first, 0, end - first);
+}
+
+/**
+ * Allocate zeroed, LAYOUT_ALIGN aligned memory whose pages sit on the nodes
+ * of the workers that own them
+ *
+ * The memory is split into n_tasks equal slices and slice i is zeroed by the
+ * worker a pool_run() of n_tasks tasks starts task i on. Use the task count
+ * the memory is later worked on with
+ *
+ * @param pool The pool
+ * @param bytes Size of the memory
+ * @param n_tasks Slices, e.g. the row bands of an image
+ * @return The memory, free() it
+ */
+void* pool_alloc(thread_pool_s* pool, size_t bytes, long n_tasks) {
+    size_t rounded = (bytes + LAYOUT_ALIGN - 1) / LAYOUT_ALIGN * LAYOUT_ALIGN;
+    void* base = aligned_alloc(LAYOUT_ALIGN, rounded > 0 ? rounded : LAYOUT_ALIGN);
+    if (base == NULL) {
+        fprintf(stderr, "Memory allocation failed for pool memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //slices of less than a page would only fight over the same pages
+    if (n_tasks > (long)(rounded / POOL_PAGE_BYTES)) n_tasks = rounded / POOL_PAGE_BYTES;
+    if (n_tasks < 1) n_tasks = 1;
+
+    pool_touch_s touch = { (char*)base, rounded, n_tasks };
+    TRACE_SCOPE("pool first touch");
+    pool_run(pool, touch_task, &touch, n_tasks, 0);
+    return base;
+}
+
+void free_thread_pool(thread_pool_s* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int w = 0; w < pool->n_workers; w++) {
+        pthread_join(pool->workers[w].thread, NULL);
+        pthread_mutex_destroy(&pool->deques[w].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
+
+//task w of a job of n_workers tasks runs on worker w, so the trio is built on its own node
+static void trio_task(void* arg, long task, int worker) {
+    pool_conv_s* conv = (pool_conv_s*)arg;
+    (void)task;
+    init_fcu_trio(conv->workers[worker].trio, conv->kernel, "pool");
+}
+
+static void free_trio_task(void* arg, long task, int worker) {
+    pool_conv_s* conv = (pool_conv_s*)arg;
+    (void)task;
+    free_fcu_trio(conv->workers[worker].trio);
+}
+
+static void band_task(void* arg, long band, int worker) {
+    pool_conv_s* conv = (pool_conv_s*)arg;
+    pool_conv_worker_s* own = &conv->workers[worker];
+    int width = conv->size;
+    fcu_storage_t* rows = conv->pixels + band * KERNEL_SIZE * width;
+
+    //an all-zero band convolves to zero, which the output already holds
+    int zero = 1;
+    for (int i = 0; i < KERNEL_SIZE * width && zero; i++) zero = storage_to_data(rows[i]) == 0.0;
+    if (zero) {
+        own->skipped++;
+        return;
+    }
+
+    //exact outputs never depend on the previous band, so every band starts from empty registers
+    unsigned long long before = multiply_count;
+    reset_fcu_trio(own->trio);
+    own->cycles += fcu_convolve_band(own->trio, rows, width, layout_row(conv->layout, conv->out, 0, band),
+                                     conv->layout->block, 0, NULL);
+    own->multiplies += multiply_count - before;
+}
+
+/**
+ * The FCU band loop of convolve_image() with one band per task, each worker
+ * running its own trio
+ *
+ * Produces the same feature map as the single trio. All-zero bands are
+ * skipped, which is what makes the bands of a sparse image uneven and the
+ * stealing worthwhile
+ *
+ * @param pool The pool
+ * @param kernel Kernel to convolve with
+ * @param pixels size x size image, ideally from pool_alloc() with layout->rows tasks
+ * @param size Width of the image in pixels
+ * @param out Zeroed feature map of layout, ideally from pool_alloc() with layout->rows tasks
+ * @param layout fcu_output_layout() of the image
+ * @param stats Cycles, skipped bands and multiplies of the run
+ */
+void pool_convolve_image(thread_pool_s* pool, kernel_s* kernel, fcu_storage_t* pixels, int size, fcu_storage_t* out,
+                         const tensor_layout_s* layout, pool_conv_stats_s* stats) {
+    int n = pool->n_workers;
+    pool_conv_s conv;
+    conv.kernel = kernel;
+    conv.pixels = pixels;
+    conv.size = size;
+    conv.out = out;
+    conv.layout = layout;
+    conv.workers = (pool_conv_worker_s*)aligned_alloc(LAYOUT_ALIGN, n * sizeof(pool_conv_worker_s));
+    if (conv.workers == NULL) {
+        fprintf(stderr, "Memory allocation failed for pool convolution\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(conv.workers, 0, n * sizeof(pool_conv_worker_s));
+
+    long steals = 0;
+    for (int w = 0; w < n; w++) steals -= pool->workers[w].steals;
+
+    pool_run(pool, trio_task, &conv, n, 0);
+    trace_scope_s scope = trace_begin("pool bands");
+    pool_run(pool, band_task, &conv, layout->rows, 1);
+    trace_end(&scope);
+    pool_run(pool, free_trio_task, &conv, n, 0);
+
+    memset(stats, 0, sizeof(pool_conv_stats_s));
+    for (int w = 0; w < n; w++) {
+        stats->cycles += conv.workers[w].cycles;
+        stats->bands_skipped += conv.workers[w].skipped;
+        stats->multiplies += conv.workers[w].multiplies;
+        steals += pool->workers[w].steals;
+    }
+    stats->steals = steals;
+
+    free(conv.workers);
+}
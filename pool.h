@@ -0,0 +1,84 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "fcu.h"
+#include "layout.h"
+
+//most workers and NUMA nodes a pool handles
+#define POOL_MAX_WORKERS 256
+#define POOL_MAX_NODES 64
+
+/**
+ * Runs task number task of a job on worker number worker
+ */
+typedef void (*pool_task_t)(void* arg, long task, int worker);
+
+/**
+ * Tasks a worker still has to run, [head, tail). The owner takes from the
+ * head, a worker that runs dry steals the back half
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    long head;
+    long tail;
+} pool_deque_s;
+
+typedef struct thread_pool_s thread_pool_s;
+
+typedef struct {
+    thread_pool_s* pool;
+    pthread_t thread;
+    int id;
+    int cpu;                //CPU the worker is pinned to, -1 if it is not
+    int node;               //NUMA node of that CPU
+    long tasks;             //tasks run over the pool's life
+    long steals;
+} pool_worker_s;
+
+/**
+ * Persistent workers that run one job of numbered tasks at a time
+ *
+ * Every job starts with task range [n * w / workers, n * (w + 1) / workers)
+ * on worker w, so jobs with the same task count hand each worker the same
+ * tasks until stealing kicks in. pool_alloc() zeroes memory slice by slice
+ * on that split, and Linux places each page on the NUMA node of the first
+ * thread to touch it, so the row bands a worker owns are on its own node.
+ * Pinned workers are placed node by node, workers next to each other in id
+ * share a node and so do their bands
+ */
+struct thread_pool_s {
+    int n_workers;
+    int n_nodes;
+    int pinned;
+    pool_worker_s* workers;
+    pool_deque_s* deques;
+
+    pthread_mutex_t lock;           //guards everything below
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int generation;                 //bumped for every job
+    int busy;                       //workers still on the current job
+    int stop;
+    pool_task_t task;
+    void* arg;
+    int steal;
+};
+
+typedef struct {
+    long cycles;
+    long bands_skipped;             //all-zero bands, their outputs are zero
+    unsigned long long multiplies;
+    long steals;
+} pool_conv_stats_s;
+
+thread_pool_s* init_thread_pool(thread_pool_s* pool, int n_workers, int pin);
+void pool_run(thread_pool_s* pool, pool_task_t task, void* arg, long n_tasks, int steal);
+void* pool_alloc(thread_pool_s* pool, size_t bytes, long n_tasks);
+void free_thread_pool(thread_pool_s* pool);
+void pool_convolve_image(thread_pool_s* pool, kernel_s* kernel, fcu_storage_t* pixels, int size, fcu_storage_t* out,
+                         const tensor_layout_s* layout, pool_conv_stats_s* stats);
+
+#endif
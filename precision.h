@@ -0,0 +1,92 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+/**
+ * Element types of the FCU datapath, chosen at compile time
+ *
+ *   gcc -g -DFCU_PRECISION=FCU_PRECISION_FP16 *.c -o sim -lpthread
+ *
+ * fcu_data_t    - what the multipliers, adders and shift registers work in
+ * fcu_storage_t - how images and feature maps are kept in memory
+ *
+ * FCU_PRECISION_DOUBLE - double everywhere (default, the original simulator)
+ * FCU_PRECISION_FLOAT  - float32 everywhere
+ * FCU_PRECISION_FP16   - IEEE half storage, float32 datapath
+ * FCU_PRECISION_BF16   - bfloat16 storage, float32 datapath
+ *
+ * FCU_DATA_MAX is the largest finite fcu_data_t
+ *
+ * Pixels are 8-bit values so all four hold the inputs exactly, the narrow
+ * storage types only round the feature map
+ */
+#define FCU_PRECISION_DOUBLE 0
+#define FCU_PRECISION_FLOAT 1
+#define FCU_PRECISION_FP16 2
+#define FCU_PRECISION_BF16 3
+
+#ifndef FCU_PRECISION
+#define FCU_PRECISION FCU_PRECISION_DOUBLE
+#endif
+
+#if FCU_PRECISION == FCU_PRECISION_DOUBLE
+typedef double fcu_data_t;
+typedef double fcu_storage_t;
+#define FCU_PRECISION_NAME "double"
+#define FCU_DATA_MAX DBL_MAX
+#elif FCU_PRECISION == FCU_PRECISION_FLOAT
+typedef float fcu_data_t;
+typedef float fcu_storage_t;
+#define FCU_PRECISION_NAME "float32"
+#define FCU_DATA_MAX FLT_MAX
+#elif FCU_PRECISION == FCU_PRECISION_FP16
+typedef float fcu_data_t;
+typedef _Float16 fcu_storage_t;
+#define FCU_PRECISION_NAME "fp16 storage / float32 datapath"
+#define FCU_DATA_MAX FLT_MAX
+#elif FCU_PRECISION == FCU_PRECISION_BF16
+typedef float fcu_data_t;
+typedef uint16_t fcu_storage_t;
+#define FCU_PRECISION_NAME "bf16 storage / float32 datapath"
+#define FCU_DATA_MAX FLT_MAX
+#else
+#error "Unknown FCU_PRECISION"
+#endif
+
+/**
+ * Widen a stored element into the datapath type
+ */
+static inline fcu_data_t storage_to_data(fcu_storage_t value) {
+#if FCU_PRECISION == FCU_PRECISION_BF16
+    //bf16 is the top half of a float32
+    uint32_t bits = (uint32_t)value << 16;
+    float res;
+    memcpy(&res, &bits, sizeof(res));
+    return res;
+#else
+    return (fcu_data_t)value;
+#endif
+}
+
+/**
+ * Narrow a datapath value for storage, rounding to nearest even
+ */
+static inline fcu_storage_t data_to_storage(fcu_data_t value) {
+#if FCU_PRECISION == FCU_PRECISION_BF16
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        //keep NaNs quiet instead of rounding them into infinity
+        return (fcu_storage_t)((bits >> 16) | 0x0040);
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (fcu_storage_t)(bits >> 16);
+#else
+    return (fcu_storage_t)value;
+#endif
+}
+
+#endif
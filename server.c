@@ -0,0 +1,469 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "engine.h"
+#include "layers.h"
+#include "layout.h"
+#include "trace.h"
+
+/**
+ * Convolution daemon
+ *
+ * The kernel bank is built once and every worker keeps its FCU trio and its
+ * image and feature map buffers between jobs. One thread per connection reads
+ * requests and queues them; workers take up to SERVER_MAX_BATCH queued jobs
+ * per wake-up, so a burst from many clients is served back to back without a
+ * round trip through the queue lock per job
+ */
+
+typedef struct server_job_s {
+    float* pixels;
+    int width;
+    int kernel;
+    float* result;
+    double submitted;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct server_job_s* next;
+} server_job_s;
+
+typedef struct server_s server_s;
+
+//one client, linked into the server's open connections until its thread exits
+typedef struct server_connection_s {
+    server_s* server;
+    int fd;
+    struct server_connection_s* next;
+} server_connection_s;
+
+struct server_s {
+    int listen_fd;
+    struct sockaddr_un address;
+    kernel_s** kernels;
+    int n_kernels;
+    double* pixel_limits;           //largest pixel magnitude each kernel takes, kernel_pixel_limit()
+
+    pthread_mutex_t lock;           //guards the queue, stop and stats
+    pthread_cond_t cond;
+    server_job_s* head;
+    server_job_s* tail;
+    int stop;
+    server_stats_s* stats;
+    server_connection_s* connections;
+    pthread_cond_t idle;            //signalled as each connection thread leaves
+};
+
+static int read_full(int fd, void* buffer, size_t length) {
+    char* p = (char*)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void* buffer, size_t length) {
+    const char* p = (const char*)buffer;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        length -= n;
+    }
+    return 1;
+}
+
+//grow-only buffer, the contents are not kept
+static void* reserve(void* buffer, size_t* capacity, size_t bytes) {
+    if (bytes <= *capacity) return buffer;
+    free(buffer);
+    buffer = malloc(bytes);
+    if (buffer == NULL) {
+        fprintf(stderr, "Memory allocation failed for server buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = bytes;
+    return buffer;
+}
+
+/**
+ * Queue a job and wait for a worker to finish it
+ *
+ * @return 1 once the job is done, 0 if the daemon is stopping and the job was refused
+ */
+static int submit_job(server_s* server, server_job_s* job) {
+    job->done = 0;
+    job->next = NULL;
+    job->submitted = now_seconds();
+
+    //the workers may already have exited, nobody would ever finish the job
+    pthread_mutex_lock(&server->lock);
+    if (server->stop) {
+        pthread_mutex_unlock(&server->lock);
+        return 0;
+    }
+    if (server->tail != NULL) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    pthread_cond_signal(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_mutex_lock(&job->lock);
+    while (!job->done) pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+    return 1;
+}
+
+/**
+ * Largest pixel magnitude the FCU datapath takes with this kernel without overflowing
+ *
+ * With pixels up to P and coefficients (h_01 and the other pre-added ones
+ * included) up to H, no pre-add, product, shift register or y value of an
+ * FCU exceeds 9 * P * max(H, 1), and the trio's sum of three FCUs 27 times
+ * that. An overflow turns into inf - inf or inf * 0 and the NaN check of
+ * multiplier() / adder() would end the whole daemon, so the limit keeps a
+ * margin of 64 below FCU_DATA_MAX
+ */
+static double kernel_pixel_limit(const kernel_s* kernel) {
+    const fcu_coefficients_s* rows[3] = { kernel->kernel_row_1, kernel->kernel_row_2, kernel->kernel_row_3 };
+    double h = 1.0;
+    for (int r = 0; r < 3; r++) {
+        fcu_data_t coefficients[6] = { rows[r]->h_0, rows[r]->h_1, rows[r]->h_2,
+                                       rows[r]->h_01, rows[r]->h_12, rows[r]->h_012 };
+        for (int i = 0; i < 6; i++) {
+            if (fabs((double)coefficients[i]) > h) h = fabs((double)coefficients[i]);
+        }
+    }
+    return (double)FCU_DATA_MAX / (64.0 * h);
+}
+
+//1 if every pixel is finite in the FCU's storage type and within limit
+static int pixels_in_range(const float* pixels, size_t n, double limit) {
+    for (size_t i = 0; i < n; i++) {
+        double value = (double)storage_to_data(data_to_storage(pixels[i]));
+        if (!isfinite(value) || fabs(value) > limit) return 0;
+    }
+    return 1;
+}
+
+//stop accepting, workers finish what is queued and exit
+static void stop_server(server_s* server) {
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+
+    //shutdown() wakes accept() on Linux, the throwaway connection everywhere else
+    shutdown(server->listen_fd, SHUT_RDWR);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        connect(fd, (struct sockaddr*)&server->address, sizeof(server->address));
+        close(fd);
+    }
+}
+
+static void* connection_thread(void* arg) {
+    server_connection_s* connection = (server_connection_s*)arg;
+    server_s* server = connection->server;
+    int fd = connection->fd;
+
+    server_job_s job;
+    memset(&job, 0, sizeof(server_job_s));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    size_t pixel_capacity = 0, result_capacity = 0;
+
+    server_request_s request;
+    while (read_full(fd, &request, sizeof(request))) {
+        server_response_s response;
+        memset(&response, 0, sizeof(response));
+        response.magic = SERVER_RESPONSE_MAGIC;
+
+        if (request.magic != SERVER_REQUEST_MAGIC ||
+            (request.op != SERVER_OP_CONVOLVE && request.op != SERVER_OP_SHUTDOWN)) {
+            response.status = SERVER_BAD_REQUEST;
+            write_full(fd, &response, sizeof(response));
+            break;
+        }
+
+        if (request.op == SERVER_OP_SHUTDOWN) {
+            write_full(fd, &response, sizeof(response));
+            stop_server(server);
+            break;
+        }
+
+        //without a sane width the stream cannot be followed any further
+        if (request.width < (uint32_t)KERNEL_SIZE || request.width > SERVER_MAX_WIDTH) {
+            response.status = SERVER_BAD_SIZE;
+            write_full(fd, &response, sizeof(response));
+            break;
+        }
+        size_t pixels = (size_t)request.width * request.width;
+        job.pixels = (float*)reserve(job.pixels, &pixel_capacity, pixels * sizeof(float));
+        if (!read_full(fd, job.pixels, pixels * sizeof(float))) break;
+
+        //a bad kernel or pixel only rejects this job, its pixels were read to stay in step
+        //NaN, Inf or an overflowing datapath would stop the whole daemon in the FCU's NaN check
+        if (request.kernel >= (uint32_t)server->n_kernels) {
+            response.status = SERVER_BAD_KERNEL;
+        } else if (!pixels_in_range(job.pixels, pixels, server->pixel_limits[request.kernel])) {
+            response.status = SERVER_BAD_PIXELS;
+        } else {
+            job.width = (int)request.width;
+            job.kernel = (int)request.kernel;
+            tensor_layout_s layout = fcu_output_layout((int)request.width, 0, 1, 1);
+            response.rows = layout.rows;
+            response.cols = layout.cols;
+            job.result = (float*)reserve(job.result, &result_capacity,
+                                         (size_t)response.rows * response.cols * sizeof(float));
+            if (!submit_job(server, &job)) {
+                response.status = SERVER_STOPPING;
+                response.rows = 0;
+                response.cols = 0;
+            }
+        }
+
+        if (response.status != SERVER_OK) {
+            pthread_mutex_lock(&server->lock);
+            server->stats->rejected++;
+            pthread_mutex_unlock(&server->lock);
+        }
+        if (!write_full(fd, &response, sizeof(response)) || response.status == SERVER_STOPPING) break;
+        if (response.status == SERVER_OK &&
+            !write_full(fd, job.result, (size_t)response.rows * response.cols * sizeof(float))) break;
+    }
+
+    free(job.pixels);
+    free(job.result);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+
+    //run_server() may return as soon as the list is empty, server is not touched after this
+    pthread_mutex_lock(&server->lock);
+    server_connection_s** link = &server->connections;
+    while (*link != connection) link = &(*link)->next;
+    *link = connection->next;
+    pthread_cond_broadcast(&server->idle);
+    pthread_mutex_unlock(&server->lock);
+
+    close(fd);
+    free(connection);
+    return NULL;
+}
+
+static void* server_worker(void* arg) {
+    server_s* server = (server_s*)arg;
+    fcu_s* fcus[3];
+    fcu_storage_t* pixels = NULL;
+    fcu_storage_t* map = NULL;
+    size_t pixel_capacity = 0, map_capacity = 0;
+
+    multiply_count = 0;
+    trace_thread_name("server worker");
+    init_fcu_trio(fcus, server->kernels[0], "srv");
+
+    for (;;) {
+        server_job_s* batch[SERVER_MAX_BATCH];
+        int n = 0;
+
+        pthread_mutex_lock(&server->lock);
+        while (server->head == NULL && !server->stop) pthread_cond_wait(&server->cond, &server->lock);
+        while (server->head != NULL && n < SERVER_MAX_BATCH) {
+            batch[n++] = server->head;
+            server->head = server->head->next;
+        }
+        if (server->head == NULL) server->tail = NULL;
+        pthread_mutex_unlock(&server->lock);
+        if (n == 0) break;
+
+        TRACE_SCOPE("server batch");
+        double start = now_seconds();
+        double queued = 0;
+        long cycles = 0;
+        unsigned long long multiplies = multiply_count;
+
+        for (int j = 0; j < n; j++) {
+            server_job_s* job = batch[j];
+            int width = job->width;
+            tensor_layout_s layout = fcu_output_layout(width, 0, 1, 1);
+            size_t entries = layout_entries(&layout);
+            queued += now_seconds() - job->submitted;
+
+            pixels = (fcu_storage_t*)reserve(pixels, &pixel_capacity, (size_t)width * width * sizeof(fcu_storage_t));
+            map = (fcu_storage_t*)reserve(map, &map_capacity, entries * sizeof(fcu_storage_t));
+            for (int i = 0; i < width * width; i++) pixels[i] = data_to_storage(job->pixels[i]);
+            memset(map, 0, entries * sizeof(fcu_storage_t));
+
+            //swap in the job's kernel rows, the trio itself stays warm
+            kernel_s* kernel = server->kernels[job->kernel];
+            fcus[0]->h = kernel->kernel_row_1;
+            fcus[1]->h = kernel->kernel_row_2;
+            fcus[2]->h = kernel->kernel_row_3;
+            reset_fcu_trio(fcus);
+
+            for (int band = 0; band < layout.rows; band++) {
+                cycles += fcu_convolve_band(fcus, pixels + band * KERNEL_SIZE * width, width,
+                                            layout_row(&layout, map, 0, band), 1, band * layout.cols, NULL);
+            }
+            for (size_t i = 0; i < entries; i++) job->result[i] = (float)storage_to_data(map[i]);
+
+            pthread_mutex_lock(&job->lock);
+            job->done = 1;
+            pthread_cond_signal(&job->cond);
+            pthread_mutex_unlock(&job->lock);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        server->stats->jobs += n;
+        server->stats->batches++;
+        server->stats->fcu_cycles += cycles;
+        server->stats->multiplies += multiply_count - multiplies;
+        server->stats->busy_seconds += now_seconds() - start;
+        server->stats->queue_seconds += queued;
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    free_fcu_trio(fcus);
+    free(pixels);
+    free(map);
+    return NULL;
+}
+
+/**
+ * Serve convolution jobs on a Unix domain socket until a client sends
+ * SERVER_OP_SHUTDOWN, see server.h for the protocol
+ *
+ * @param socket_path Path of the socket, replaced if it exists
+ * @param n_threads Worker threads, each with its own FCU trio
+ * @param stats Job, batch and timing counts of the whole run
+ * @return 1 once the daemon has shut down, 0 if the socket could not be set up
+ */
+int run_server(char* socket_path, int n_threads, server_stats_s* stats) {
+    double start = now_seconds();
+    memset(stats, 0, sizeof(server_stats_s));
+
+    server_s server;
+    memset(&server, 0, sizeof(server_s));
+    server.stats = stats;
+    server.address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(server.address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 0;
+    }
+    strcpy(server.address.sun_path, socket_path);
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr*)&server.address, sizeof(server.address)) != 0 ||
+        listen(server.listen_fd, 64) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", socket_path, strerror(errno));
+        if (server.listen_fd >= 0) close(server.listen_fd);
+        return 0;
+    }
+
+    //a client hanging up mid response must not take the daemon down
+    signal(SIGPIPE, SIG_IGN);
+
+    server.n_kernels = kernel_bank_size();
+    server.kernels = (kernel_s**)malloc(server.n_kernels * sizeof(kernel_s*));
+    server.pixel_limits = (double*)malloc(server.n_kernels * sizeof(double));
+    pthread_t* threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (server.kernels == NULL || server.pixel_limits == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed for server\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < server.n_kernels; k++) {
+        server.kernels[k] = init_bank_kernel(k);
+        server.pixel_limits[k] = kernel_pixel_limit(server.kernels[k]);
+    }
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.cond, NULL);
+    pthread_cond_init(&server.idle, NULL);
+    for (int t = 0; t < n_threads; t++) {
+        if (pthread_create(&threads[t], NULL, server_worker, &server) != 0) {
+            fprintf(stderr, "Could not start server worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("Serving on %s with %d workers and %d kernels\n", socket_path, n_threads, server.n_kernels);
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(server.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        server_connection_s* connection = (server_connection_s*)malloc(sizeof(server_connection_s));
+        if (connection == NULL) {
+            fprintf(stderr, "Memory allocation failed for connection\n");
+            exit(EXIT_FAILURE);
+        }
+        connection->server = &server;
+        connection->fd = fd;
+
+        pthread_mutex_lock(&server.lock);
+        int stop = server.stop;
+        if (!stop) {
+            stats->connections++;
+            connection->next = server.connections;
+            server.connections = connection;
+        }
+        pthread_mutex_unlock(&server.lock);
+        if (stop) {
+            close(fd);
+            free(connection);
+            break;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_thread, connection) != 0) {
+            fprintf(stderr, "Could not start connection thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
+
+    //accept only fails on its own if the socket broke
+    stop_server(&server);
+    for (int t = 0; t < n_threads; t++) pthread_join(threads[t], NULL);
+
+    //server lives on this stack, so wait for every connection thread to leave. Queued jobs
+    //are done and new ones are refused, shutdown() wakes the threads blocked on a read
+    pthread_mutex_lock(&server.lock);
+    for (server_connection_s* c = server.connections; c != NULL; c = c->next) shutdown(c->fd, SHUT_RDWR);
+    while (server.connections != NULL) pthread_cond_wait(&server.idle, &server.lock);
+    pthread_mutex_unlock(&server.lock);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.cond);
+    pthread_cond_destroy(&server.idle);
+
+    close(server.listen_fd);
+    unlink(socket_path);
+    for (int k = 0; k < server.n_kernels; k++) free_bank_kernel(server.kernels[k]);
+    free(server.kernels);
+    free(server.pixel_limits);
+    free(threads);
+
+    stats->wall_seconds = now_seconds() - start;
+    return 1;
+}
@@ -0,0 +1,70 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "fcu.h"
+
+/**
+ * Binary protocol of the --serve daemon over a Unix domain stream socket
+ *
+ * A client sends any number of requests on one connection and gets one
+ * response per request, in order. All fields are native-endian uint32, the
+ * socket never leaves the machine
+ *
+ *   request:  server_request_s, then width * width float32 pixels, row major
+ *   response: server_response_s, then rows * cols float32 feature map entries
+ *
+ * The feature map comes back dense and row major in its exact shape,
+ * width / KERNEL_SIZE rows of width - KERNEL_SIZE + 1 columns
+ */
+#define SERVER_REQUEST_MAGIC 0x51554346     //"FCUQ"
+#define SERVER_RESPONSE_MAGIC 0x52554346    //"FCUR"
+
+#define SERVER_MAX_WIDTH 4096
+//jobs a worker takes off the queue per wake-up
+#define SERVER_MAX_BATCH 16
+
+typedef enum {
+    SERVER_OP_CONVOLVE = 0,
+    SERVER_OP_SHUTDOWN = 1          //stop the daemon once queued jobs are done, no payload
+} server_op_e;
+
+typedef enum {
+    SERVER_OK = 0,
+    SERVER_BAD_REQUEST = 1,         //unknown magic or op, the connection is closed after the response
+    SERVER_BAD_SIZE = 2,            //width below KERNEL_SIZE or above SERVER_MAX_WIDTH
+    SERVER_BAD_KERNEL = 3,          //kernel index outside the bank
+    SERVER_BAD_PIXELS = 4,          //a pixel is NaN, infinite or large enough to overflow the FCU datapath
+    SERVER_STOPPING = 5             //the daemon is shutting down and takes no more jobs
+} server_status_e;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t width;
+    uint32_t kernel;                //index into the kernel bank
+} server_request_s;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t rows;
+    uint32_t cols;
+} server_response_s;
+
+typedef struct {
+    long connections;
+    long jobs;
+    long rejected;
+    long batches;
+    long fcu_cycles;
+    unsigned long long multiplies;
+    double busy_seconds;            //summed over the workers
+    double queue_seconds;           //summed over the jobs, submit to first FCU cycle
+    double wall_seconds;
+} server_stats_s;
+
+int run_server(char* socket_path, int n_threads, server_stats_s* stats);
+
+#endif
@@ -4,14 +4,56 @@
 #include <string.h>
 
 #include "fcu.h"
+#include "winograd.h"
+#include "engine.h"
+#include "pipeline.h"
+#include "io.h"
+#include "temporal.h"
+#include "sparse.h"
+#include "layers.h"
+#include "epilogue.h"
+#include "trace.h"
+#include "accel.h"
+#include "sweep.h"
+#include "backward.h"
+#include "server.h"
+#include "layout.h"
+#include "lanes.h"
+#include "workload.h"
+#include "incremental.h"
+#include "pool.h"
+
+//most shapes that can be listed in one run
+#define MAX_IMAGES 64
+//most --edit rectangles per run
+#define MAX_EDITS 16
+//runs per worker count of --scaling, the fastest is reported
+#define SCALING_REPS 3
 
 kernel_s* init_kernel(kernel_s* kernel);
 fcu_coefficients_s* init_fcu_coefficients(fcu_coefficients_s* h);
-fcu_s* init_fcu(fcu_s* fcu, char* fcu_name);
 void grab_next_ip_set(fcu_inputs_s* inputs); 
-int init_pixel_inputs(int size, int mode, char* filename);
-int slide_inputs(fcu_s* fcu);
-void generate_feature_map(char* filename, int size);
+int init_pixel_inputs(int size, const workload_s* workload, char* filename, int n_threads);
+void generate_feature_map(char* filename, const tensor_layout_s* layout, int channel);
+void convolve_image(conv_engine_e engine, winograd_kernel_s* winograd_kernel, int zero_skip, epilogue_s* epilogue,
+                    int backward, int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                    char* output_filename);
+void run_backward(int n_threads, char* input_filename);
+void run_scaling(int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                 char* output_filename);
+void edit_image(int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                char* output_filename, image_rect_s* edits, fcu_data_t* fills, int n_edits);
+int serve(int argc, char* argv[]);
+void convolve_sequence(int input_image_size, const workload_s* workloads, char** input_filenames,
+                       char** output_filenames, int n_frames, int n_threads);
+void convolve_layer(int input_image_size, const workload_s* workloads, char** input_filenames, int channels, int groups,
+                    int pointwise, int n_threads, int layout_block, epilogue_s* epilogue);
+int parse_layout_option(char* value, int* block);
+int parse_edit_option(char* value, image_rect_s* rect, fcu_data_t* fill);
+int parse_epilogue_option(char* option, char* value, epilogue_s* epilogue);
+int parse_accel_option(char* option, char* value, accel_config_s* config);
+void debug_cycle_hook(fcu_outputs_s* results, int idx);
+int shape_filename(char* shape, char* filename);
 
 
 void printSimulatorStartMessage();
@@ -19,13 +61,14 @@ void printSimulatorEndMessage();
 void print_kernel(kernel_s* kernel);
 void print_fcu_outputs(fcu_outputs_s* outputs, int starting, int ending, int idx);
 void print_shift_reg(queue_s* queue);
-void print_image_pixels(double* pixels, int size);
+void print_image_pixels(fcu_storage_t* pixels, int size);
 void print_current_input_set();
-void check_fcu_inputs_to_img_pixels(double* pixels);
+void check_fcu_inputs_to_img_pixels(fcu_storage_t* pixels);
+void print_multiply_report(conv_engine_e engine, unsigned long long multiplies, long outputs);
 
 
 
-double* image_pixels;
+fcu_storage_t* image_pixels;
 /**
  * used to store the output of the convolution layer 
  * the size of the feature map is controlled by hyperparameters
@@ -36,7 +79,7 @@ double* image_pixels;
  * 
  * Output size = ((W - F + 2P) / S) + 1
  */
-double* output_feature_map;
+fcu_storage_t* output_feature_map;
 
 /**
  * Used for combining outputs of the FCU to generate the feature map
@@ -54,19 +97,70 @@ fcu_s* fcu_array[3];
 // Global variable to control step-through mode
 int DEBUG_STEP_THRU_MODE = 0;
 int DEBUG_FCU_SLIDING_INPUTS = 0;
+int sleep_duration = 0;
+
+//--no-output, large benchmark runs skip writing their feature maps as text
+int write_outputs = 1;
 
 
 int main(int argc, char* argv[]) {
+    //the daemon takes no shapes, every job brings its own image
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0) return serve(argc, argv);
+
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s <image_size> <shape> [--debug speed_option]\n", argv[0]);
+        fprintf(stderr, "Usage: %s --serve <socket> [--threads N] [--trace file]\n", argv[0]);
+        fprintf(stderr, "       %s <image_size> <shape>[,shape...] [--debug speed_option] [--engine engine] [--pipeline] [--sequence] [--zero-skip] [--backward] [--edit rect]... [--scaling] [layer options] [--layout layout] [workload options] [epilogue options] [--trace file] [--accel [accelerator options]] [--sweep spec]\n", argv[0]);
         fprintf(stderr, "Shapes:\n");
         fprintf(stderr, "  square: Use square input shape\n");
         fprintf(stderr, "  circle: Use circle input shape\n");
         fprintf(stderr, "  triangle: Use triangle input shape\n");
         fprintf(stderr, "  pentagon: Use pentagon input shape\n");
         fprintf(stderr, "  star: Use star input shape\n");
+        fprintf(stderr, "  random, blobs, gradient, sparse: Generate a synthetic input of that kind in memory\n");
+        fprintf(stderr, "  Several shapes separated by commas are run back to back\n");
         fprintf(stderr, "Options:\n");
         fprintf(stderr, "  --debug: Enable sliding input visualization (requires speed option)\n");
+        fprintf(stderr, "  --engine: Convolution engine (fcu, winograd2, winograd4), default fcu\n");
+        fprintf(stderr, "  --pipeline: Overlap loading, FCU compute and storing on separate threads\n");
+        fprintf(stderr, "  --sequence: Treat the shapes as video frames and skip tiles that did not change\n");
+        fprintf(stderr, "  --zero-skip: Skip all-zero regions of the image in the FCU engine\n");
+        fprintf(stderr, "  --backward: Also run the input and weight gradients of 0.5 * sum(out^2) through the FCUs,\n");
+        fprintf(stderr, "              check them numerically and write the input gradient to grad_<shape>.txt\n");
+        fprintf(stderr, "  --edit ROW,COL,HEIGHT,WIDTH[,VALUE]: After the first pass fill the rectangle with VALUE (default 255)\n");
+        fprintf(stderr, "              and refresh only the outputs it touches, repeat for more edits (at most %d)\n", MAX_EDITS);
+        fprintf(stderr, "  --scaling: Benchmark the FCU engine on a pinned, NUMA-aware thread pool from 1 to --threads workers\n");
+        fprintf(stderr, "  --depthwise: Treat the shapes as channels and convolve each with its own kernel\n");
+        fprintf(stderr, "  --groups G: Grouped convolution of the shapes as channels in G groups\n");
+        fprintf(stderr, "  --pointwise N: Fuse a 1x1 convolution to N channels behind the grouped stage\n");
+        fprintf(stderr, "  --threads N: Worker threads for the layer modes, default all cores\n");
+        fprintf(stderr, "  --layout L: Storage of the layer input and output tensors, nchw (default) or nchw<N>c, e.g. nchw8c\n");
+        fprintf(stderr, "  --trace FILE: Time each stage, write a Chrome trace to FILE and print a summary\n");
+        fprintf(stderr, "Workload options:\n");
+        fprintf(stderr, "  --channels N: Repeat the shapes up to N images or channels, at most %d\n", MAX_IMAGES);
+        fprintf(stderr, "  --seed N: Seed of the synthetic inputs, default 1\n");
+        fprintf(stderr, "  --density D: Fraction of the tiles of a sparse input that are on, default 0.1\n");
+        fprintf(stderr, "  --no-output: Do not write the feature maps, for large benchmark runs\n");
+        fprintf(stderr, "Epilogue options, applied to each output before it is stored:\n");
+        fprintf(stderr, "  --bias B[,B...]: Bias per filter, or one for all filters\n");
+        fprintf(stderr, "  --activation A: relu, relu6 or leaky[:slope] (default slope 0.01)\n");
+        fprintf(stderr, "  --clamp MIN,MAX: Clamp outputs to [MIN, MAX]\n");
+        fprintf(stderr, "  --requantize SCALE[,ZERO_POINT]: Requantize outputs to int8\n");
+        fprintf(stderr, "  --pool N: Fused N x N max pooling, the pooled map is written instead\n");
+        fprintf(stderr, "  --accel: Run the shapes as the channels of a layer on the accelerator timing model instead\n");
+        fprintf(stderr, "Accelerator options (with --accel, sizes in bytes with an optional K or M suffix):\n");
+        fprintf(stderr, "  --trios N: Parallel FCU trios, default 1\n");
+        fprintf(stderr, "  --input-buffer SIZE: Input line buffer, default 64K\n");
+        fprintf(stderr, "  --weight-buffer SIZE: Weight buffer, default 16K\n");
+        fprintf(stderr, "  --output-buffer SIZE: Output partial sum buffer, default 32K\n");
+        fprintf(stderr, "  --dram-bw B: DRAM bytes per cycle, default 16\n");
+        fprintf(stderr, "  --dram-latency N: DRAM latency in cycles, default 100\n");
+        fprintf(stderr, "  --clock MHZ: Clock used to report time, default 500\n");
+        fprintf(stderr, "  --sweep SPEC: Run every combination of the listed accelerator parameters on --threads workers,\n");
+        fprintf(stderr, "                e.g. \"trios=1:16:x2;input-buffer=8K,64K;precision=fp32,fp16\"\n");
+        fprintf(stderr, "                (trios, kernel, stride, input-buffer, weight-buffer, output-buffer, precision,\n");
+        fprintf(stderr, "                dram-bw, dram-latency; lo:hi, lo:hi:step and lo:hi:xfactor ranges). Repeated\n");
+        fprintf(stderr, "                values run once, fp16 and bf16 are both 2 byte elements to the model\n");
+        fprintf(stderr, "  --sweep-out FILE: CSV the sweep appends to and skips finished points of, default sweep.csv\n");
         fprintf(stderr, "Speed options (required with --debug):\n");
         fprintf(stderr, "  -f: fast (0.020 seconds)\n");
         fprintf(stderr, "  -m: medium (0.125 seconds)\n");
@@ -75,62 +169,343 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    // Parse shape selection
-    char* input_filename = (char*)malloc(256 * sizeof(char));
-    if (strcmp(argv[2], "square") == 0) {
-        strcpy(input_filename, "inputs/square.txt");
-    } else if (strcmp(argv[2], "circle") == 0) {
-        strcpy(input_filename, "inputs/circle.txt");
-    } else if (strcmp(argv[2], "triangle") == 0) {
-        strcpy(input_filename, "inputs/triangle.txt");
-    } else if (strcmp(argv[2], "pentagon") == 0) {
-        strcpy(input_filename, "inputs/pentagon.txt");
-    } else if (strcmp(argv[2], "star") == 0) {
-        strcpy(input_filename, "inputs/star.txt");
-    } else {
-        fprintf(stderr, "Invalid shape. Use 'square', 'circle', 'triangle', 'pentagon', or 'star'\n");
-        free(input_filename);
+    //smaller images have no full 3x3 window, so no feature map
+    int input_image_size = atoi(argv[1]);
+    if (input_image_size < KERNEL_SIZE) {
+        fprintf(stderr, "Image size must be at least %d (the kernel size), got %s\n", KERNEL_SIZE, argv[1]);
         return EXIT_FAILURE;
     }
 
-    // Parse debug and speed options
-    int sleep_duration = 0;
+    // Parse shape selection
+    char* input_filenames[MAX_IMAGES];
+    char* output_filenames[MAX_IMAGES];
+    char* shape_names[MAX_IMAGES];
+    workload_s workloads[MAX_IMAGES];
+    int n_shapes = 0;
+
+    char* shapes = strdup(argv[2]);
+    for (char* shape = strtok(shapes, ","); shape != NULL; shape = strtok(NULL, ",")) {
+        if (n_shapes == MAX_IMAGES) {
+            fprintf(stderr, "Too many shapes, at most %d per run\n", MAX_IMAGES);
+            return EXIT_FAILURE;
+        }
+
+        input_filenames[n_shapes] = (char*)malloc(256 * sizeof(char));
+        workloads[n_shapes].kind = WORKLOAD_NONE;
+        if (!shape_filename(shape, input_filenames[n_shapes]) && !parse_workload_kind(shape, &workloads[n_shapes].kind)) {
+            fprintf(stderr, "Invalid shape. Use 'square', 'circle', 'triangle', 'pentagon', 'star' or one of the\n"
+                            "synthetic inputs 'random', 'blobs', 'gradient' or 'sparse'\n");
+            return EXIT_FAILURE;
+        }
+        shape_names[n_shapes] = shape;
+        n_shapes++;
+    }
+
+    // Parse debug, speed, engine, pipeline and sequence options
     DEBUG_STEP_THRU_MODE = 0;
     DEBUG_FCU_SLIDING_INPUTS = 0;
-    
-    if (argc >= 4) {
-        if (strcmp(argv[3], "--debug") == 0) {
+    conv_engine_e engine = ENGINE_FCU;
+    int use_pipeline = 0;
+    int use_sequence = 0;
+    int zero_skip = 0;
+    int backward = 0;
+    image_rect_s edits[MAX_EDITS];
+    fcu_data_t edit_fills[MAX_EDITS];
+    int n_edits = 0;
+    int use_scaling = 0;
+    int groups = 0;
+    int pointwise = 0;
+    int layout_block = 0;
+    int n_channels = 0;
+    uint64_t seed = 1;
+    double density = 0.1;
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    epilogue_s epilogue;
+    memset(&epilogue, 0, sizeof(epilogue_s));
+    int use_epilogue = 0;
+    char* trace_filename = NULL;
+    int use_accel = 0;
+    accel_config_s accel_config;
+    accel_config.n_trios = 1;
+    accel_config.input_buffer_bytes = 64 * 1024;
+    accel_config.weight_buffer_bytes = 16 * 1024;
+    accel_config.output_buffer_bytes = 32 * 1024;
+    accel_config.dram_bytes_per_cycle = 16;
+    accel_config.dram_latency = 100;
+    accel_config.element_bytes = sizeof(fcu_storage_t);
+    accel_config.clock_mhz = 500;
+    sweep_spec_s sweep;
+    int use_sweep = 0;
+    char* sweep_filename = "sweep.csv";
+
+    for (int arg = 3; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--debug") == 0) {
             DEBUG_FCU_SLIDING_INPUTS = 1;
             
             // When debug is enabled, speed option is required
-            if (argc < 5) {
+            if (arg + 1 >= argc) {
                 fprintf(stderr, "Error: --debug requires a speed option (-f, -m, -s, or --step)\n");
-                free(input_filename);
                 return EXIT_FAILURE;
             }
+            arg++;
             
             // Parse speed option
-            if (strcmp(argv[4], "-f") == 0) {
+            if (strcmp(argv[arg], "-f") == 0) {
                 sleep_duration = 5000;  // 0.005 seconds
-            } else if (strcmp(argv[4], "-m") == 0) {
+            } else if (strcmp(argv[arg], "-m") == 0) {
                 sleep_duration = 125000; // 0.125 seconds
-            } else if (strcmp(argv[4], "-s") == 0) {
+            } else if (strcmp(argv[arg], "-s") == 0) {
                 sleep_duration = 250000; // 0.250 seconds
-            } else if (strcmp(argv[4], "--step") == 0) {
+            } else if (strcmp(argv[arg], "--step") == 0) {
                 DEBUG_STEP_THRU_MODE = 1;
                 sleep_duration = 0;
             } else {
                 fprintf(stderr, "Invalid speed option. Use -f, -m, -s, or --step\n");
-                free(input_filename);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(argv[arg], "--engine") == 0) {
+            if (arg + 1 >= argc) {
+                fprintf(stderr, "Error: --engine requires fcu, winograd2 or winograd4\n");
+                return EXIT_FAILURE;
+            }
+            arg++;
+
+            if (strcmp(argv[arg], "fcu") == 0) {
+                engine = ENGINE_FCU;
+            } else if (strcmp(argv[arg], "winograd2") == 0) {
+                engine = ENGINE_WINOGRAD_F2;
+            } else if (strcmp(argv[arg], "winograd4") == 0) {
+                engine = ENGINE_WINOGRAD_F4;
+            } else {
+                fprintf(stderr, "Invalid engine. Use fcu, winograd2 or winograd4\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[arg], "--pipeline") == 0) {
+            use_pipeline = 1;
+        } else if (strcmp(argv[arg], "--sequence") == 0) {
+            use_sequence = 1;
+        } else if (strcmp(argv[arg], "--zero-skip") == 0) {
+            zero_skip = 1;
+        } else if (strcmp(argv[arg], "--backward") == 0) {
+            backward = 1;
+        } else if (strcmp(argv[arg], "--edit") == 0) {
+            if (n_edits == MAX_EDITS || arg + 1 >= argc ||
+                !parse_edit_option(argv[arg + 1], &edits[n_edits], &edit_fills[n_edits])) {
+                fprintf(stderr, "Error: --edit requires ROW,COL,HEIGHT,WIDTH[,VALUE], at most %d times\n", MAX_EDITS);
+                return EXIT_FAILURE;
+            }
+            n_edits++;
+            arg++;
+        } else if (strcmp(argv[arg], "--scaling") == 0) {
+            use_scaling = 1;
+        } else if (strcmp(argv[arg], "--depthwise") == 0) {
+            groups = -1;
+        } else if (strcmp(argv[arg], "--groups") == 0 || strcmp(argv[arg], "--pointwise") == 0 ||
+                   strcmp(argv[arg], "--threads") == 0) {
+            if (arg + 1 >= argc || atoi(argv[arg + 1]) < 1) {
+                fprintf(stderr, "Error: %s requires a positive count\n", argv[arg]);
+                return EXIT_FAILURE;
+            }
+            if (strcmp(argv[arg], "--groups") == 0) {
+                groups = atoi(argv[arg + 1]);
+            } else if (strcmp(argv[arg], "--pointwise") == 0) {
+                pointwise = atoi(argv[arg + 1]);
+            } else {
+                n_threads = atoi(argv[arg + 1]);
+            }
+            arg++;
+        } else if (strcmp(argv[arg], "--channels") == 0) {
+            if (arg + 1 >= argc || atoi(argv[arg + 1]) < 1 || atoi(argv[arg + 1]) > MAX_IMAGES) {
+                fprintf(stderr, "Error: --channels requires a count between 1 and %d\n", MAX_IMAGES);
+                return EXIT_FAILURE;
+            }
+            n_channels = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--seed") == 0) {
+            char* end = NULL;
+            if (arg + 1 < argc) seed = strtoull(argv[arg + 1], &end, 10);
+            if (end == NULL || end == argv[arg + 1] || *end != '\0') {
+                fprintf(stderr, "Error: --seed requires a non-negative integer\n");
+                return EXIT_FAILURE;
+            }
+            arg++;
+        } else if (strcmp(argv[arg], "--density") == 0) {
+            char* end = NULL;
+            if (arg + 1 < argc) density = strtod(argv[arg + 1], &end);
+            if (end == NULL || end == argv[arg + 1] || *end != '\0' || density < 0.0 || density > 1.0) {
+                fprintf(stderr, "Error: --density requires a fraction between 0 and 1\n");
+                return EXIT_FAILURE;
+            }
+            arg++;
+        } else if (strcmp(argv[arg], "--no-output") == 0) {
+            write_outputs = 0;
+        } else if (strcmp(argv[arg], "--layout") == 0) {
+            if (arg + 1 >= argc || !parse_layout_option(argv[arg + 1], &layout_block)) {
+                fprintf(stderr, "Error: --layout requires nchw or nchw<N>c\n");
+                return EXIT_FAILURE;
+            }
+            arg++;
+        } else if (strcmp(argv[arg], "--bias") == 0 || strcmp(argv[arg], "--activation") == 0 ||
+                   strcmp(argv[arg], "--clamp") == 0 || strcmp(argv[arg], "--requantize") == 0 ||
+                   strcmp(argv[arg], "--pool") == 0) {
+            if (arg + 1 >= argc || !parse_epilogue_option(argv[arg], argv[arg + 1], &epilogue)) {
+                fprintf(stderr, "Error: invalid or missing value for %s\n", argv[arg]);
+                return EXIT_FAILURE;
+            }
+            use_epilogue = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--trace") == 0) {
+            if (arg + 1 >= argc) {
+                fprintf(stderr, "Error: --trace requires an output file\n");
+                return EXIT_FAILURE;
+            }
+            trace_filename = argv[++arg];
+        } else if (strcmp(argv[arg], "--accel") == 0) {
+            use_accel = 1;
+        } else if (strcmp(argv[arg], "--sweep") == 0) {
+            if (arg + 1 >= argc || !parse_sweep_spec(argv[arg + 1], &sweep)) {
+                fprintf(stderr, "Error: invalid or missing sweep for --sweep\n");
+                return EXIT_FAILURE;
+            }
+            use_sweep = use_accel = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--sweep-out") == 0) {
+            if (arg + 1 >= argc) {
+                fprintf(stderr, "Error: --sweep-out requires an output file\n");
+                return EXIT_FAILURE;
+            }
+            sweep_filename = argv[++arg];
+        } else if (strcmp(argv[arg], "--trios") == 0 || strcmp(argv[arg], "--input-buffer") == 0 ||
+                   strcmp(argv[arg], "--weight-buffer") == 0 || strcmp(argv[arg], "--output-buffer") == 0 ||
+                   strcmp(argv[arg], "--dram-bw") == 0 || strcmp(argv[arg], "--dram-latency") == 0 ||
+                   strcmp(argv[arg], "--clock") == 0) {
+            if (arg + 1 >= argc || !parse_accel_option(argv[arg], argv[arg + 1], &accel_config)) {
+                fprintf(stderr, "Error: invalid or missing value for %s\n", argv[arg]);
+                return EXIT_FAILURE;
+            }
+            arg++;
         } else {
-            fprintf(stderr, "Invalid option. Use --debug followed by a speed option\n");
-            free(input_filename);
+            fprintf(stderr, "Invalid option. Use --debug followed by a speed option, --engine followed by an engine, --pipeline, --sequence, --zero-skip, --backward,\n"
+                            "--edit, --scaling, --depthwise, --groups, --pointwise, --threads, --layout, --channels, --seed, --density, --no-output, --trace,\n"
+                            "--accel, --sweep, an epilogue or an accelerator option\n");
             return EXIT_FAILURE;
         }
     }
 
+    //--channels repeats the shapes in order, every synthetic image is its own stream of the seed
+    int n_images = n_channels > 0 ? n_channels : n_shapes;
+    int use_workload = 0;
+    for (int i = 0; i < n_images; i++) {
+        int s = i % n_shapes;
+        if (i >= n_shapes) {
+            input_filenames[i] = (char*)malloc(256 * sizeof(char));
+            strcpy(input_filenames[i], input_filenames[s]);
+            shape_names[i] = shape_names[s];
+            workloads[i].kind = workloads[s].kind;
+        }
+        workloads[i].seed = seed;
+        workloads[i].stream = i;
+        workloads[i].density = density;
+        if (workloads[i].kind != WORKLOAD_NONE) {
+            snprintf(input_filenames[i], 256, "%s%d", shape_names[i], i + 1);
+            use_workload = 1;
+        }
+    }
+
+    //the pipeline streams row bands of the text images through the FCU trio
+    if (use_pipeline && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_workload)) {
+        fprintf(stderr, "--pipeline only supports the fcu engine on text shapes without --debug\n");
+        return EXIT_FAILURE;
+    }
+
+    //the sequence mode caches FCU outputs per tile between frames
+    if (use_sequence && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline)) {
+        fprintf(stderr, "--sequence only supports the fcu engine without --debug or --pipeline\n");
+        return EXIT_FAILURE;
+    }
+
+    //zero skipping builds its occupancy map from the whole loaded image
+    if (zero_skip && (engine != ENGINE_FCU || use_pipeline || use_sequence)) {
+        fprintf(stderr, "--zero-skip only supports the fcu engine without --pipeline or --sequence\n");
+        return EXIT_FAILURE;
+    }
+
+    //in the layer modes the shapes are the channels of one image
+    int use_layer = groups != 0 || pointwise > 0;
+    if (groups == -1) groups = n_images;
+    if (groups == 0) groups = 1;
+    if (use_layer && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip)) {
+        fprintf(stderr, "--depthwise, --groups and --pointwise only support the fcu engine on their own\n");
+        return EXIT_FAILURE;
+    }
+    if (n_images % groups != 0) {
+        fprintf(stderr, "--groups must divide the number of channels (%d)\n", n_images);
+        return EXIT_FAILURE;
+    }
+
+    //the epilogue is fused into the FCU band loop and the layer outputs
+    if (use_epilogue && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip)) {
+        fprintf(stderr, "Epilogue options only support the fcu engine without --debug, --pipeline, --sequence or --zero-skip\n");
+        return EXIT_FAILURE;
+    }
+    if (layout_block != 0 && !use_layer) {
+        fprintf(stderr, "--layout only applies to the layer modes\n");
+        return EXIT_FAILURE;
+    }
+    if (layout_block == 0) layout_block = 1;
+    if (use_layer && epilogue.pool > 1) {
+        fprintf(stderr, "--pool is not supported in the layer modes\n");
+        return EXIT_FAILURE;
+    }
+    int filters = use_layer ? (pointwise > 0 ? pointwise : n_images) : 1;
+    if (epilogue.n_bias > 1 && epilogue.n_bias != filters) {
+        fprintf(stderr, "--bias takes one value or one per filter (%d)\n", filters);
+        return EXIT_FAILURE;
+    }
+
+    //the backward pass runs on the feature map of the plain FCU forward pass
+    if (backward && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip ||
+                     use_layer || use_epilogue)) {
+        fprintf(stderr, "--backward only supports the fcu engine on its own\n");
+        return EXIT_FAILURE;
+    }
+
+    //edits refresh the persisted map of one plain FCU convolution
+    if (n_edits > 0 && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip ||
+                        use_layer || use_epilogue || backward || use_accel || n_images != 1)) {
+        fprintf(stderr, "--edit only supports a single image in the fcu engine on its own\n");
+        return EXIT_FAILURE;
+    }
+
+    //the scaling benchmark runs the plain FCU band loop on one image
+    if (use_scaling && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip ||
+                        use_layer || use_epilogue || backward || use_accel || n_edits > 0 || n_images != 1)) {
+        fprintf(stderr, "--scaling only supports a single image in the fcu engine on its own\n");
+        return EXIT_FAILURE;
+    }
+    if (use_scaling && n_threads > POOL_MAX_WORKERS) n_threads = POOL_MAX_WORKERS;
+
+    //the accelerator model only needs the layer shape
+    if (use_accel && (engine != ENGINE_FCU || DEBUG_FCU_SLIDING_INPUTS || use_pipeline || use_sequence || zero_skip ||
+                      use_epilogue || pointwise > 0)) {
+        fprintf(stderr, "--accel and --sweep cannot be combined with other engines or modes\n");
+        return EXIT_FAILURE;
+    }
+
+    //a single image keeps writing output.txt, several get one file per shape
+    //and the frames of a sequence one file per frame
+    for (int i = 0; i < n_images; i++) {
+        output_filenames[i] = (char*)malloc(256 * sizeof(char));
+        if (n_images == 1) {
+            strcpy(output_filenames[i], "output.txt");
+        } else if (use_sequence) {
+            snprintf(output_filenames[i], 256, "output_frame%d.txt", i + 1);
+        } else if (workloads[i].kind != WORKLOAD_NONE || n_images > n_shapes) {
+            snprintf(output_filenames[i], 256, "output_%s%d.txt", shape_names[i], i + 1);
+        } else {
+            snprintf(output_filenames[i], 256, "output_%s.txt", shape_names[i]);
+        }
+    }
+
     printSimulatorStartMessage();
 
     //initialize the kernel - ideally read from a file as ip without recompilation
@@ -139,154 +514,935 @@ int main(int argc, char* argv[]) {
 
     print_kernel(kernel);
 
+    //the Winograd engines transform the kernel once, here at load time
+    winograd_kernel_s* winograd_kernel = NULL;
+    if (engine == ENGINE_WINOGRAD_F2) {
+        winograd_kernel = init_winograd_kernel(winograd_kernel, kernel, 2);
+    } else if (engine == ENGINE_WINOGRAD_F4) {
+        winograd_kernel = init_winograd_kernel(winograd_kernel, kernel, 4);
+    }
+
+    //initialize each FCU to have inputs, ptr to kernel, shift regs, and op struct
+    init_fcu_trio(fcu_array, kernel, "fcu");
+
+    if (trace_filename != NULL) trace_start();
+    double wall_start = now_seconds();
+
+    if (use_accel) {
+        accel_layer_s layer;
+        layer.size = input_image_size;
+        layer.channels = n_images;
+        layer.filters = n_images;
+        layer.groups = groups;
+        layer.kernel_size = kernel_size;
+        layer.stride = STRIDE;
+
+        if (use_sweep) {
+            sweep_stats_s stats;
+            run_sweep(&sweep, &accel_config, &layer, sweep_filename, n_threads, &stats);
+
+            printf("\n*************** Sweep ***************\n");
+            printf("Points: %ld\tCached: %ld\tRun: %ld\tInvalid: %ld\n", stats.points, stats.cached, stats.run, stats.invalid);
+            printf("Workers: %d\tSteals: %ld\n", n_threads < stats.points ? n_threads : (int)stats.points, stats.steals);
+            if (stats.best_cycles >= 0) {
+                printf("Fewest cycles: %ld\n", stats.best_cycles);
+                printf("  (size,channels,filters,groups,kernel,stride,trios,input_buffer,weight_buffer,output_buffer,element_bytes,dram_bw,dram_latency)\n");
+                printf("  %s\n", stats.best_key);
+            }
+            printf("Results: %s\n", sweep_filename);
+            printf("Wall time: %.3f ms\n", stats.wall_seconds * 1e3);
+            printf("*************************************\n");
+        } else {
+            const char* error = accel_config_error(&accel_config, &layer);
+            if (error != NULL) {
+                fprintf(stderr, "Accelerator configuration cannot run the layer: %s\n", error);
+                return EXIT_FAILURE;
+            }
+
+            accel_report_s report;
+            simulate_accelerator(&accel_config, &layer, &report);
+            print_accel_report(&accel_config, &layer, &report);
+            printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+        }
+    } else if (use_pipeline) {
+        pipeline_stats_s stats;
+
+        multiply_count = 0;
+        run_pipeline(fcu_array, input_filenames, output_filenames, n_images, input_image_size, &stats);
+
+        //y_0, y_1 and y_2 overlap as the band slides by one, the map has one entry per cycle
+        tensor_layout_s layout = fcu_output_layout(input_image_size, 0, 1, 1);
+        print_multiply_report(engine, multiply_count, (long)n_images * layout.rows * layout.cols);
+
+        printf("\n*************** Pipeline ***************\n");
+        printf("Images: %d\tRow blocks: %ld\n", n_images, stats.blocks);
+        printf("Reader busy:  %8.3f ms\n", stats.reader_seconds * 1e3);
+        printf("Compute busy: %8.3f ms\n", stats.compute_seconds * 1e3);
+        printf("Writer busy:  %8.3f ms\n", stats.writer_seconds * 1e3);
+        printf("Wall time:    %8.3f ms\n", stats.wall_seconds * 1e3);
+        printf("****************************************\n");
+    } else if (use_layer) {
+        convolve_layer(input_image_size, workloads, input_filenames, n_images, groups, pointwise, n_threads,
+                       layout_block, use_epilogue ? &epilogue : NULL);
+        printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+    } else if (use_scaling) {
+        run_scaling(n_threads, input_image_size, &workloads[0], input_filenames[0], output_filenames[0]);
+        printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+    } else if (n_edits > 0) {
+        edit_image(n_threads, input_image_size, &workloads[0], input_filenames[0], output_filenames[0], edits, edit_fills,
+                   n_edits);
+        printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+    } else if (use_sequence) {
+        convolve_sequence(input_image_size, workloads, input_filenames, output_filenames, n_images, n_threads);
+        printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+    } else {
+        for (int i = 0; i < n_images; i++) {
+            if (n_images > 1) printf("\nImage %d: %s\n", i + 1, input_filenames[i]);
+            convolve_image(engine, winograd_kernel, zero_skip, use_epilogue ? &epilogue : NULL, backward, n_threads,
+                           input_image_size, &workloads[i], input_filenames[i], output_filenames[i]);
+        }
+        printf("\nWall time: %.3f ms\n", (now_seconds() - wall_start) * 1e3);
+    }
+
+    if (trace_filename != NULL) {
+        trace_stop();
+        trace_print_summary();
+        trace_write_chrome(trace_filename);
+        printf("Trace written to %s\n", trace_filename);
+        trace_free();
+    }
+
+    for (int i = 0; i < n_images; i++) {
+        free(input_filenames[i]);
+        free(output_filenames[i]);
+    }
+    free(shapes);
+    free(winograd_kernel);
+    free(epilogue.bias);
+
+    printSimulatorEndMessage();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Daemon mode: ./sim --serve <socket> [--threads N] [--trace file]
+ *
+ * Serves convolution jobs over a Unix domain socket until a client asks it to
+ * shut down, then prints what it served. See server.h for the protocol
+ */
+int serve(int argc, char* argv[]) {
+    char* socket_path = argv[2];
+    char* trace_filename = NULL;
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int arg = 3; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc && atoi(argv[arg + 1]) >= 1) {
+            n_threads = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_filename = argv[++arg];
+        } else {
+            fprintf(stderr, "Invalid option. --serve takes --threads followed by a count and --trace followed by a file\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printSimulatorStartMessage();
+    if (trace_filename != NULL) trace_start();
+
+    server_stats_s stats;
+    if (!run_server(socket_path, n_threads, &stats)) return EXIT_FAILURE;
+
+    printf("\n**************** Server ****************\n");
+    printf("Connections: %ld\tJobs: %ld\tRejected: %ld\n", stats.connections, stats.jobs, stats.rejected);
+    printf("Batches: %ld (%.2f jobs per batch)\n", stats.batches,
+           stats.batches > 0 ? (double)stats.jobs / stats.batches : 0.0);
+    printf("FCU cycles: %ld\tMultiplies: %llu\n", stats.fcu_cycles, stats.multiplies);
+    printf("Mean queue wait: %.3f ms\n", stats.jobs > 0 ? stats.queue_seconds / stats.jobs * 1e3 : 0.0);
+    printf("Mean compute per job: %.3f ms\n", stats.jobs > 0 ? stats.busy_seconds / stats.jobs * 1e3 : 0.0);
+    printf("Wall time: %.3f s\n", stats.wall_seconds);
+    printf("****************************************\n");
+
+    if (trace_filename != NULL) {
+        trace_stop();
+        trace_print_summary();
+        trace_write_chrome(trace_filename);
+        printf("Trace written to %s\n", trace_filename);
+        trace_free();
+    }
+
+    printSimulatorEndMessage();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Load one image, run the selected engine over it and write its feature map
+ *
+ * @param engine Engine to run
+ * @param winograd_kernel Transformed kernel, only used by the Winograd engines
+ * @param zero_skip Skip runs of all-zero windows in the FCU engine
+ * @param epilogue Applied to each output as it is completed, NULL for none
+ * @param backward Run the backward pass on the feature map afterwards
+ * @param n_threads Worker threads of the backward pass and the workload generator
+ * @param input_image_size Width of the image requested on the command line
+ * @param workload Synthetic input to generate, kind WORKLOAD_NONE to read input_filename
+ * @param input_filename Text image to read, names a synthetic input
+ * @param output_filename Where to write the feature map
+ */
+void convolve_image(conv_engine_e engine, winograd_kernel_s* winograd_kernel, int zero_skip, epilogue_s* epilogue,
+                    int backward, int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                    char* output_filename) {
+    TRACE_SCOPE("convolve image");
+
     // Initialize pixel inputs
-    int input_image_size = atoi(argv[1]);
-    image_size = init_pixel_inputs(input_image_size, 0, input_filename);
-    
-    // Free the allocated filename string
-    free(input_filename);
+    image_size = init_pixel_inputs(input_image_size, workload, input_filename, n_threads);
     
-    int padding = image_size - input_image_size;
+    if (engine != ENGINE_FCU) {
+        //Winograd works on whole 2D tiles and produces the dense stride 1 feature map
+        int feature_map_size = image_size - kernel_size + 1;
+        tensor_layout_s layout = make_tensor_layout(feature_map_size, feature_map_size, 1, 1);
+        output_feature_map = (fcu_storage_t*)calloc(feature_map_size * feature_map_size, sizeof(fcu_storage_t));
+        if (output_feature_map == NULL) {
+            fprintf(stderr, "Memory allocation failed for feature map\n");
+            exit(EXIT_FAILURE);
+        }
+
+        multiply_count = 0;
+        trace_scope_s scope = trace_begin("winograd");
+        winograd_conv2d(winograd_kernel, image_pixels, image_size, output_feature_map, feature_map_size);
+        trace_end(&scope);
+        print_multiply_report(engine, multiply_count, (long)feature_map_size * feature_map_size);
+
+        generate_feature_map(output_filename, &layout, 0);
+        if (DEBUG_FEATURE_MAP) {
+            printf("\nFeature Map Output\n");
+            for (int i = 0; i < feature_map_size; i++) {
+                printf("Row %d:\t", i+1);
+                for (int j = 0; j < feature_map_size; j++) {
+                    printf("%.0f\t", (double)storage_to_data(output_feature_map[i * feature_map_size + j]));
+                }
+                printf("\n");
+            }
+        }
 
-    //malloc size of the feature map
-    int feature_map_size = ((input_image_size - kernel_size + 2 * padding) / kernel_size) + 1;
+        free(output_feature_map);
+        free(image_pixels);
+        return;
+    }
 
+    //the image is already padded, so the exact shape is that of a padding 0 convolution of it
+    tensor_layout_s layout = fcu_output_layout(image_size, 0, 1, 1);
+    output_feature_map = (fcu_storage_t*)calloc(layout_entries(&layout), sizeof(fcu_storage_t));
+    if (output_feature_map == NULL) {
+        fprintf(stderr, "Memory allocation failed for feature map\n");
+        exit(EXIT_FAILURE);
+    }
 
-    output_feature_map = (double*)malloc(image_size * image_size / 3 * sizeof(double));
+    //the fused pooling folds pool x pool blocks of the feature map as they finish
+    int pool = epilogue != NULL && epilogue->pool > 1 ? epilogue->pool : 1;
+    int pooled_rows = layout.rows / pool;
+    int pooled_cols = layout.cols / pool;
+    fcu_storage_t* pooled = NULL;
+    if (pool > 1) {
+        pooled = (fcu_storage_t*)malloc(pooled_rows * pooled_cols * sizeof(fcu_storage_t));
+        if (pooled == NULL) {
+            fprintf(stderr, "Memory allocation failed for pooled map\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     if (DEBUG_IMAGE_PIXELS) print_image_pixels(image_pixels, image_size);
 
-    //initialize each FCU to have inputs, ptr to kernel, shift regs, and op struct
-    for (int i = 0; i < 3; i++) {
-        char* name = (char*)malloc(7 * sizeof(char));
-        fcu_array[i] = init_fcu(fcu_array[i], name);
+    //call the FCU algorithm on the input set, one band of KERNEL_SIZE rows at a time
+    int print_cycles = DEBUG_FCU_SLIDING_INPUTS || DEBUG_INPUT_ASSIGNEMNT || DEBUG_INPUT_SLIDING;
+    long cycles = 0;
+    multiply_count = 0;
+    reset_fcu_trio(fcu_array);
+
+    occupancy_map_s* occupancy = NULL;
+    if (zero_skip) occupancy = init_occupancy_map(occupancy, image_pixels, image_size);
+
+    //output row r comes from band r
+    for (int band = 0; band < layout.rows; band++) {
+        fcu_storage_t* rows = image_pixels + (band * KERNEL_SIZE * image_size);
+        fcu_storage_t* out = layout_row(&layout, output_feature_map, 0, band);
+        TRACE_SCOPE("fcu band");
+
+        if (occupancy != NULL) {
+            cycles += fcu_convolve_band_sparse(occupancy, fcu_array, band, rows, out, layout.block);
+        } else if (epilogue != NULL) {
+            fcu_storage_t* pooled_row = NULL;
+            if (band / pool < pooled_rows && pooled != NULL) {
+                pooled_row = pooled + (band / pool) * pooled_cols;
+                if (band % pool == 0) init_pooled_row(pooled_row, layout.cols, pool);
+            }
+            cycles += fcu_convolve_band_epilogue(fcu_array, rows, image_size, out, layout.block, epilogue,
+                                                 epilogue_bias(epilogue, 0), pooled_row);
+        } else {
+            cycles += fcu_convolve_band(fcu_array, rows, image_size, out, layout.block, band * layout.cols,
+                                        print_cycles ? debug_cycle_hook : NULL);
+        }
     }
 
-    //Each FCU has a set of FIR filter coefficients. These coefficients are stored in the variable 'kernel'
-    //Basically assign each FCU's 'h' var to point to the correct set of filter coefficients
-    fcu_array[0]->h = kernel->kernel_row_1;
-    fcu_array[1]->h = kernel->kernel_row_2;
-    fcu_array[2]->h = kernel->kernel_row_3;
+    if (occupancy != NULL) {
+        long total = occupancy->cycles_run + occupancy->cycles_skipped;
+        printf("\n************** Zero skip ***************\n");
+        printf("FCU cycles run:     %ld\n", occupancy->cycles_run);
+        printf("FCU cycles skipped: %ld (%.1f%%)\n", occupancy->cycles_skipped,
+               total > 0 ? 100.0 * occupancy->cycles_skipped / total : 0.0);
+        printf("****************************************\n");
+
+        //skipped cycles still count as outputs, they are known to be zero
+        cycles = total;
+        free_occupancy_map(occupancy);
+    }
 
-    // assign inputs to the first set of image pixels
-    //assign the first set of three pointers to the inputs struct
-    //for each subsequent FCU, the ptrs to the inputs are the base plus the dimension offset for x_0
+    //y_0, y_1 and y_2 overlap as the band slides by one, the map has one entry per cycle
+    print_multiply_report(engine, multiply_count, (long)layout.rows * layout.cols);
 
-    for (int i = 0; i < 3; i++) {
-        fcu_array[i]->inputs->x_0 = image_pixels + (image_size*i);
-        fcu_array[i]->inputs->x_1 = image_pixels+1+(image_size*i);
-        fcu_array[i]->inputs->x_2 = image_pixels+2+(image_size*i);
+    if (pooled != NULL) {
+        //the pooled map replaces the feature map on disk, one pooled row per line
+        if (write_outputs) {
+            FILE* file = fopen(output_filename, "w");
+            if (file == NULL) {
+                fprintf(stderr, "Could not create output file\n");
+                exit(EXIT_FAILURE);
+            }
+            write_feature_map_values(file, pooled, pooled_rows * pooled_cols, 0, pooled_cols);
+            fclose(file);
+        }
+        printf("\nPooled map: %d x %d\n", pooled_rows, pooled_cols);
+        free(pooled);
+    } else {
+        generate_feature_map(output_filename, &layout, 0);
+    }
+    if (DEBUG_FEATURE_MAP) {
+        printf("\nFeature Map Output\n");
+        for (int i = 0; i < layout.rows; i++) {
+            printf("Row %d:\t", i+1);
+            fcu_storage_t* row = layout_row(&layout, output_feature_map, 0, i);
+            for (int j = 0; j < layout.cols; j++) {
+                printf("%.0f\t", (double)storage_to_data(row[j * layout.block]));
+            }
+            printf("\n");
+        }
     }
 
+    if (backward) run_backward(n_threads, input_filename);
 
-    if (DEBUG_INPUT_ASSIGNEMNT) {
-        printf("\n\nBEGIN Initial input assignments to FCUs\n");
-        for (int i = 0; i < 3; i++) {
-            printf("\tFCU #%d: ", i+1);
-            printf("%.2f\t%.2f\t%.2f\n", *(fcu_array[i]->inputs->x_0),
-                *(fcu_array[i]->inputs->x_1),
-                *(fcu_array[i]->inputs->x_2));
+    free(output_feature_map);
+    free(image_pixels);
+}
+
+/**
+ * Backpropagate the loss 0.5 * sum(out^2) through the FCU convolution of the
+ * loaded image, report the multiplies against a direct 3x3 and check both
+ * gradients numerically. The input gradient goes to grad_<shape>.txt
+ *
+ * Uses the globals of the forward pass: kernel, image_pixels, image_size and
+ * output_feature_map, which is also the gradient of the loss. The map has to
+ * be dense, fcu_output_layout() with a block of 1
+ *
+ * @param n_threads Worker threads
+ * @param input_filename Image the forward pass loaded, names the output
+ */
+void run_backward(int n_threads, char* input_filename) {
+    fcu_storage_t* grad_in = (fcu_storage_t*)calloc(image_size * image_size, sizeof(fcu_storage_t));
+    if (grad_in == NULL) {
+        fprintf(stderr, "Memory allocation failed for input gradient\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fcu_data_t grad_weights[3][3];
+    backward_stats_s stats;
+    trace_scope_s scope = trace_begin("backward");
+    double start = now_seconds();
+    fcu_backward(kernel, image_pixels, output_feature_map, image_size, grad_in, grad_weights, n_threads, &stats);
+    double seconds = now_seconds() - start;
+    trace_end(&scope);
+
+    //a direct 3x3 takes 9 multiplies per feature map entry, for each of the three passes
+    tensor_layout_s layout = fcu_output_layout(image_size, 0, 1, 1);
+    long cycles = stats.cycles + stats.priming_cycles;
+    double direct = 9.0 * layout.rows * layout.cols;
+    double training = 18.0 * stats.cycles + stats.input_multiplies + stats.weight_multiplies;
+    printf("\n*************** Backward ***************\n");
+    printf("Loss: 0.5 * sum(out^2)\n");
+    printf("FCU cycles per pass: %ld (+%ld priming over %d tiles)\n", stats.cycles, stats.priming_cycles, stats.tiles);
+    printf("Input gradient multiplies:  %llu (%.2f per cycle, direct %.0f)\n", stats.input_multiplies,
+           cycles > 0 ? (double)stats.input_multiplies / cycles : 0.0, direct);
+    printf("Weight gradient multiplies: %llu (%.2f per cycle, direct %.0f)\n", stats.weight_multiplies,
+           stats.cycles > 0 ? (double)stats.weight_multiplies / stats.cycles : 0.0, direct);
+    printf("Training step multiplies (forward + both gradients): %.0f, %.2fx direct %.0f\n",
+           training, direct > 0 ? training / (3 * direct) : 0.0, 3 * direct);
+    printf("Backward time: %.3f ms\n", seconds * 1e3);
+    printf("\nWeight gradient\n");
+    for (int r = 0; r < 3; r++) {
+        printf("%.1f\t%.1f\t%.1f\n", (double)grad_weights[r][0], (double)grad_weights[r][1], (double)grad_weights[r][2]);
+    }
+
+    backward_check_s check;
+    check_backward(kernel, image_pixels, image_size, grad_in, grad_weights, &check);
+    printf("\nNumerical check (central differences, relative to the largest gradient)\n");
+    printf("Weights: %.3g\t%s\n", check.weight_error, check.weight_error <= BACKWARD_CHECK_TOLERANCE ? "ok" : "MISMATCH");
+    printf("Pixels (%d sampled): %.3g\t%s\n", check.pixels_checked, check.input_error,
+           check.input_error <= BACKWARD_CHECK_TOLERANCE ? "ok" : "MISMATCH");
+    printf("****************************************\n");
+
+    //grad_<shape>.txt next to the outputs, one image row per line
+    char* base = strrchr(input_filename, '/');
+    char filename[256];
+    snprintf(filename, sizeof(filename), "grad_%s", base != NULL ? base + 1 : input_filename);
+    if (write_outputs) {
+        FILE* file = fopen(filename, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Could not create output file\n");
+            exit(EXIT_FAILURE);
         }
-        printf("END Initial input assignments to FCUs\n");
+        write_feature_map_values(file, grad_in, image_size * image_size, 0, image_size);
+        fclose(file);
+        printf("Input gradient written to %s\n", filename);
     }
-    //call the FCU algorithm on the input set
-    int counter = 0;
 
-    fcu_outputs_s* results = (fcu_outputs_s*)malloc(sizeof(fcu_outputs_s));
+    free(grad_in);
+}
 
-    //slide the inputs over by the stride amount
-    do {
-        if (DEBUG_STEP_THRU_MODE) {
-            // Manual step-through mode - wait for user input
-            printf("Press Enter to continue...");
-            getchar();
+/**
+ * Convolve one image into a persisted feature map, then apply each edit to
+ * the pixels and refresh only the outputs it reaches. Reports the cycles and
+ * time of every update next to the full pass, checks the final map against a
+ * full recompute and writes it to output_filename
+ *
+ * @param n_threads Threads generating a synthetic input
+ * @param input_image_size Width of the image requested on the command line
+ * @param workload Synthetic input to generate, kind WORKLOAD_NONE to read input_filename
+ * @param input_filename Text image to read, names a synthetic input
+ * @param output_filename Where to write the edited feature map
+ * @param edits Rectangles to fill, in order
+ * @param fills Pixel value of each rectangle
+ * @param n_edits Number of edits
+ */
+void edit_image(int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                char* output_filename, image_rect_s* edits, fcu_data_t* fills, int n_edits) {
+    image_size = init_pixel_inputs(input_image_size, workload, input_filename, n_threads);
+    multiply_count = 0;
+
+    double start = now_seconds();
+    trace_scope_s scope = trace_begin("full pass");
+    incremental_map_s* map = init_incremental_map(NULL, kernel, image_pixels, image_size);
+    trace_end(&scope);
+    long full_cycles = map->cycles_run;
+    double full_seconds = now_seconds() - start;
+
+    printf("\n**************** Edits *****************\n");
+    printf("Full pass: %ld FCU cycles, %.3f ms\n", full_cycles, full_seconds * 1e3);
+    for (int e = 0; e < n_edits; e++) {
+        image_rect_s* edit = &edits[e];
+        for (int r = edit->row; r < edit->row + edit->rows && r < image_size; r++) {
+            for (int c = edit->col; c < edit->col + edit->cols && c < image_size; c++) {
+                image_pixels[r * image_size + c] = data_to_storage(fills[e]);
+            }
         }
-        //call the FCU pipeline 
-        fcu_array[0]->outputs = three_parallel_fcu(fcu_array[0]->inputs, kernel->kernel_row_1, fcu_array[0]->shift_reg_1, fcu_array[0]->shift_reg_2);
-        fcu_array[1]->outputs = three_parallel_fcu(fcu_array[1]->inputs, kernel->kernel_row_1, fcu_array[1]->shift_reg_1, fcu_array[1]->shift_reg_2);
-        fcu_array[2]->outputs = three_parallel_fcu(fcu_array[2]->inputs, kernel->kernel_row_1, fcu_array[2]->shift_reg_1, fcu_array[2]->shift_reg_2);
-        
-        //combine the outputs of each fcu into one fcu_outputs struct
-        results->y_0 = fcu_array[0]->outputs->y_0 + fcu_array[1]->outputs->y_0 + fcu_array[2]->outputs->y_0;
-        results->y_1 = fcu_array[0]->outputs->y_1 + fcu_array[1]->outputs->y_1 + fcu_array[2]->outputs->y_1;
-        results->y_2 = fcu_array[0]->outputs->y_2 + fcu_array[1]->outputs->y_2 + fcu_array[2]->outputs->y_2;
-        
-        //assign to the output array
 
-        
+        image_rect_s affected;
+        start = now_seconds();
+        scope = trace_begin("incremental update");
+        long cycles = update_incremental_map(map, edit, &affected);
+        trace_end(&scope);
+        double seconds = now_seconds() - start;
 
-        output_feature_map[counter] += results->y_0;
-        output_feature_map[counter + 1] += results->y_1;
-        output_feature_map[counter + 2] += results->y_2;
+        printf("Edit %d: %d x %d at (%d, %d) -> outputs %d x %d at (%d, %d), %ld FCU cycles (%.2f%% of full), %.3f ms\n",
+               e + 1, edit->rows, edit->cols, edit->row, edit->col, affected.rows, affected.cols, affected.row,
+               affected.col, cycles, full_cycles > 0 ? 100.0 * cycles / full_cycles : 0.0, seconds * 1e3);
+    }
 
-        
+    //the same image through the plain band loop of convolve_image()
+    output_feature_map = alloc_layout(&map->layout);
+    reset_fcu_trio(fcu_array);
+    for (int band = 0; band < map->layout.rows; band++) {
+        fcu_convolve_band(fcu_array, image_pixels + band * KERNEL_SIZE * image_size, image_size,
+                          layout_row(&map->layout, output_feature_map, 0, band), map->layout.block, 0, NULL);
+    }
+    int match = memcmp(output_feature_map, map->map, layout_entries(&map->layout) * sizeof(fcu_storage_t)) == 0;
+    printf("Matches a full recompute: %s\n", match ? "yes" : "NO");
+    printf("****************************************\n");
+    free(output_feature_map);
+
+    output_feature_map = map->map;
+    generate_feature_map(output_filename, &map->layout, 0);
+    free_incremental_map(map);
+    free(image_pixels);
+}
 
-        if (DEBUG_FCU_SLIDING_INPUTS) {
-            usleep(sleep_duration);
-            check_fcu_inputs_to_img_pixels(image_pixels);
-            printf("Feature Map IDX: %d (Y0), %d (Y1), %d (Y2)\n", counter, counter +1, counter +2);
-            if (DEBUG_FCU_OUTPUTS) print_fcu_outputs(results, 0, 0, counter);
+/**
+ * Scaling benchmark of the FCU engine on the thread pool
+ *
+ * Convolves the image with 1, 2, 4, ... workers up to n_threads, each count on
+ * a fresh pinned pool whose copy of the image and feature map are first
+ * touched band by band by the workers that own them. Reports the fastest of
+ * SCALING_REPS runs per count, checks every map against the single trio of
+ * convolve_image() and writes the last one to output_filename
+ *
+ * @param n_threads Most workers to run with
+ * @param input_image_size Width of the image requested on the command line
+ * @param workload Synthetic input to generate, kind WORKLOAD_NONE to read input_filename
+ * @param input_filename Text image to read, names a synthetic input
+ * @param output_filename Where to write the feature map
+ */
+void run_scaling(int n_threads, int input_image_size, const workload_s* workload, char* input_filename,
+                 char* output_filename) {
+    image_size = init_pixel_inputs(input_image_size, workload, input_filename, n_threads);
+    tensor_layout_s layout = fcu_output_layout(image_size, 0, 1, 1);
+    size_t image_bytes = (size_t)image_size * image_size * sizeof(fcu_storage_t);
+    size_t map_bytes = layout_entries(&layout) * sizeof(fcu_storage_t);
+
+    //the reference, one trio over every band
+    fcu_storage_t* reference = alloc_layout(&layout);
+    reset_fcu_trio(fcu_array);
+    double start = now_seconds();
+    for (int band = 0; band < layout.rows; band++) {
+        fcu_convolve_band(fcu_array, image_pixels + band * KERNEL_SIZE * image_size, image_size,
+                          layout_row(&layout, reference, 0, band), layout.block, 0, NULL);
+    }
+    double trio_seconds = now_seconds() - start;
+
+    printf("\n*************** Scaling ****************\n");
+    printf("Bands: %d\tSingle trio: %.3f ms\n", layout.rows, trio_seconds * 1e3);
+    printf("Workers  Nodes   Time (ms)  Speedup  Efficiency  Steals  Zero bands  Match\n");
+
+    double one_seconds = 0.0;
+    int pinned = 0;
+    for (int n = 1; ; n = n * 2 < n_threads ? n * 2 : n_threads) {
+        thread_pool_s* pool = init_thread_pool(NULL, n, 1);
+        pinned = pool->pinned;
+        fcu_storage_t* pixels = (fcu_storage_t*)pool_alloc(pool, image_bytes, layout.rows);
+        output_feature_map = (fcu_storage_t*)pool_alloc(pool, map_bytes, layout.rows);
+        memcpy(pixels, image_pixels, image_bytes);
+
+        pool_conv_stats_s stats;
+        double best = 0.0;
+        long steals = 0;
+        for (int rep = 0; rep < SCALING_REPS; rep++) {
+            //the pages stay where the first touch put them
+            memset(output_feature_map, 0, map_bytes);
+            start = now_seconds();
+            pool_convolve_image(pool, kernel, pixels, image_size, output_feature_map, &layout, &stats);
+            double seconds = now_seconds() - start;
+            if (rep == 0 || seconds < best) best = seconds;
+            steals += stats.steals;
         }
-        
-        
-        
-        //if the counter hits the end of a row
-        if (counter != 0 && (counter + 3) % (image_size) == 0) {
-            counter += 3;
-        } else {
-            counter = counter + 1;
-        }
-        //print the current inputs
-        if (DEBUG_INPUT_ASSIGNEMNT) {
-            printf("\nInput assignments to FCUs\n");
-            for (int i = 0; i < 3; i++) {
-                printf("\tFCU #%d: ", i+1);
-                printf("%.2f\t%.2f\t%.2f\n", *(fcu_array[i]->inputs->x_0),
-                    *(fcu_array[i]->inputs->x_1),
-                    *(fcu_array[i]->inputs->x_2));
-            }
-            printf("Input assignments to FCUs\n");
+        if (n == 1) one_seconds = best;
+
+        int match = memcmp(output_feature_map, reference, map_bytes) == 0;
+        printf("%7d  %5d  %10.3f  %6.2fx  %9.1f%%  %6ld  %10ld  %s\n", n, pool->n_nodes, best * 1e3,
+               one_seconds / best, 100.0 * one_seconds / best / n, steals / SCALING_REPS, stats.bands_skipped,
+               match ? "yes" : "NO");
+
+        free(pixels);
+        free_thread_pool(pool);
+        if (n == n_threads) break;
+        free(output_feature_map);
+    }
+    printf("Workers pinned: %s\n", pinned ? "yes" : "no");
+    printf("****************************************\n");
+
+    generate_feature_map(output_filename, &layout, 0);
+    free(output_feature_map);
+    free(reference);
+    free(image_pixels);
+}
+
+/**
+ * Convolve a sequence of frames, reusing the FCU outputs of tiles that did not
+ * change since the previous frame, and report how many tiles were skipped
+ *
+ * @param input_image_size Width of every frame
+ * @param workloads Synthetic input of each frame, kind WORKLOAD_NONE for a text frame
+ * @param input_filenames Frames in order
+ * @param output_filenames Feature map file for each frame
+ * @param n_frames Number of frames
+ * @param n_threads Threads generating synthetic frames
+ */
+void convolve_sequence(int input_image_size, const workload_s* workloads, char** input_filenames,
+                       char** output_filenames, int n_frames, int n_threads) {
+    temporal_cache_s* cache = init_temporal_cache(NULL, input_image_size);
+    tensor_layout_s layout = fcu_output_layout(input_image_size, 0, 1, 1);
+    long cycles = 0;
+    long outputs = 0;
+    multiply_count = 0;
+
+    printf("\n*************** Sequence ***************\n");
+    for (int i = 0; i < n_frames; i++) {
+        TRACE_SCOPE("sequence frame");
+        image_size = init_pixel_inputs(input_image_size, &workloads[i], input_filenames[i], n_threads);
+        output_feature_map = (fcu_storage_t*)calloc(layout_entries(&layout), sizeof(fcu_storage_t));
+        if (output_feature_map == NULL) {
+            fprintf(stderr, "Memory allocation failed for feature map\n");
+            exit(EXIT_FAILURE);
         }
 
-        //print the combined outputs
-        
+        long reused = cache->tiles_reused;
+        long computed = cache->tiles_computed;
+        trace_scope_s scope = trace_begin("temporal convolve");
+        cycles += temporal_convolve_frame(cache, fcu_array, image_pixels, output_feature_map);
+        outputs += (long)layout.rows * layout.cols;
+        trace_end(&scope);
+        reused = cache->tiles_reused - reused;
+        computed = cache->tiles_computed - computed;
+
+        printf("Frame %d (%s): %ld of %ld tiles reused\n", i + 1, input_filenames[i],
+               reused, reused + computed);
+
+        generate_feature_map(output_filenames[i], &layout, 0);
+        free(output_feature_map);
+        free(image_pixels);
+    }
+
+    long total = cache->tiles_reused + cache->tiles_computed;
+    printf("Skip ratio: %.1f%% (%ld of %ld tiles)\n",
+           total > 0 ? 100.0 * cache->tiles_reused / total : 0.0, cache->tiles_reused, total);
+    printf("FCU cycles run: %ld\n", cycles);
+    printf("****************************************\n");
+
+    print_multiply_report(ENGINE_FCU, multiply_count, outputs);
+    free_temporal_cache(cache);
+}
 
-        if (DEBUG_INPUT_SLIDING) {
+/**
+ * Run a depthwise / grouped layer, with an optional fused pointwise stage, on
+ * the shapes given as the channels of one image. Output channel N is written
+ * to output_ch<N>.txt
+ *
+ * @param input_image_size Width of every channel
+ * @param workloads Synthetic input of each channel, kind WORKLOAD_NONE for a text image
+ * @param input_filenames One text image per channel
+ * @param channels Number of channels
+ * @param groups Number of groups, channels for depthwise
+ * @param pointwise Output channels of the fused 1x1 stage, 0 for none
+ * @param n_threads Worker threads
+ * @param layout_block Channels per block of the input and output tensors, 1 for dense planes
+ * @param epilogue Applied to the final outputs, NULL for none
+ */
+void convolve_layer(int input_image_size, const workload_s* workloads, char** input_filenames, int channels, int groups,
+                    int pointwise, int n_threads, int layout_block, epilogue_s* epilogue) {
+    conv_layer_s* layer = init_conv_layer(NULL, channels, groups, pointwise);
+
+    image_size = input_image_size;
+    while (image_size % STRIDE != 0) {
+        image_size = image_size + 1;
+    }
 
-            printf("\tPixels");
-            printf("\t\tInput set %d", counter);
-            printf("\t\tKernel\n");
-            print_current_input_set();
+    //each text image is converted into its channel of the blocked input as it is loaded,
+    //synthetic channels are generated in place
+    tensor_layout_s in_layout = make_tensor_layout(image_size, image_size, channels, layout_block);
+    fcu_storage_t* input = alloc_layout(&in_layout);
+    trace_scope_s load = trace_begin("load layer input");
+    for (int c = 0; c < channels; c++) {
+        if (workloads[c].kind != WORKLOAD_NONE) {
+            generate_workload(&workloads[c], &in_layout, input, c, input_image_size, n_threads);
+            continue;
         }
+        init_pixel_inputs(input_image_size, NULL, input_filenames[c], n_threads);
+        pack_layout_channel(&in_layout, input, c, image_pixels);
+        free(image_pixels);
+    }
+    trace_end(&load);
+
+    int out_channels = pointwise > 0 ? pointwise : channels;
+    tensor_layout_s layout = fcu_output_layout(image_size, 0, out_channels, layout_block);
+    output_feature_map = alloc_layout(&layout);
+
+    layer_stats_s stats;
+    trace_scope_s scope = trace_begin("conv layer");
+    run_conv_layer(layer, input, &in_layout, output_feature_map, &layout, n_threads, epilogue, &stats);
+    trace_end(&scope);
+
+    printf("\n***************** Layer ****************\n");
+    printf("Channels: %d\tGroups: %d\tPointwise: %d\n", channels, groups, pointwise);
+    printf("FCU cycles: %ld\n", stats.fcu_cycles);
+    printf("FCU multiplies: %llu\n", stats.fcu_multiplies);
+    printf("Pointwise multiplies: %llu\n", stats.pointwise_multiplies);
+    printf("****************************************\n");
 
-        
+    for (int o = 0; o < out_channels; o++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "output_ch%d.txt", o + 1);
+        generate_feature_map(filename, &layout, o);
+    }
+    free(input);
+    free(output_feature_map);
+    free_conv_layer(layer);
+}
+
+/**
+ * Parse the value of --layout
+ *
+ * @param value nchw for dense planes or nchw<N>c for blocks of N channels
+ * @param block Set to the channels per block
+ * @return 1 on success, 0 if the value is invalid
+ */
+int parse_layout_option(char* value, int* block) {
+    char* end;
 
-    } while(slide_inputs(fcu_array[0]) &&
-            slide_inputs(fcu_array[1]) &&
-            slide_inputs(fcu_array[2]));
+    if (strcmp(value, "nchw") == 0) {
+        *block = 1;
+        return 1;
+    }
+    if (strncmp(value, "nchw", 4) != 0) return 0;
+    long n = strtol(value + 4, &end, 10);
+    if (end == value + 4 || strcmp(end, "c") != 0 || n < 1 || n > FCU_MAX_LANES) return 0;
+    *block = (int)n;
+    return 1;
+}
 
-    generate_feature_map("output.txt", feature_map_size);
-    if (DEBUG_FEATURE_MAP) {
-        printf("\nFeature Map Output\n");
-        int i;
-        for(i = 0; i < image_size / 3; i++) {
+/**
+ * Parse the value of --edit
+ *
+ * @param value ROW,COL,HEIGHT,WIDTH with an optional ,VALUE
+ * @param rect Set to the rectangle
+ * @param fill Set to VALUE, 255 if it is left out
+ * @return 1 on success, 0 if the value is invalid
+ */
+int parse_edit_option(char* value, image_rect_s* rect, fcu_data_t* fill) {
+    long fields[4];
+    char* p = value;
+    char* end;
+
+    for (int i = 0; i < 4; i++) {
+        fields[i] = strtol(p, &end, 10);
+        if (end == p || fields[i] < 0 || (i < 3 && *end != ',')) return 0;
+        p = end + 1;
+    }
+    if (fields[2] < 1 || fields[3] < 1) return 0;
+    rect->row = (int)fields[0];
+    rect->col = (int)fields[1];
+    rect->rows = (int)fields[2];
+    rect->cols = (int)fields[3];
+
+    *fill = 255.0;
+    if (*end == '\0') return 1;
+    if (*end != ',') return 0;
+    p = end + 1;
+    *fill = strtod(p, &end);
+    return end != p && *end == '\0';
+}
 
-            printf("Row %d:\t", i+1 % (image_size / 3));
+/**
+ * Parse the value of one epilogue option into the epilogue
+ *
+ * @param option The option, e.g. --bias
+ * @param value The argument following it
+ * @param epilogue Updated in place
+ * @return 1 on success, 0 if the value is invalid
+ */
+int parse_epilogue_option(char* option, char* value, epilogue_s* epilogue) {
+    char* end;
+
+    if (strcmp(option, "--bias") == 0) {
+        free(epilogue->bias);
+        epilogue->bias = (fcu_data_t*)malloc(MAX_IMAGES * sizeof(fcu_data_t));
+        if (epilogue->bias == NULL) {
+            fprintf(stderr, "Memory allocation failed for bias\n");
+            exit(EXIT_FAILURE);
+        }
+        epilogue->n_bias = 0;
+        for (char* p = value; ; p = end + 1) {
+            if (epilogue->n_bias == MAX_IMAGES) return 0;
+            epilogue->bias[epilogue->n_bias++] = strtod(p, &end);
+            if (end == p) return 0;
+            if (*end != ',') break;
+        }
+        return *end == '\0';
+    }
 
-            for (int j = i * image_size; j < (i + 1) * image_size; j++) {
-                printf("%.0f\t", output_feature_map[j]);
+    if (strcmp(option, "--activation") == 0) {
+        if (strcmp(value, "relu") == 0) {
+            epilogue->activation = ACTIVATION_RELU;
+        } else if (strcmp(value, "relu6") == 0) {
+            epilogue->activation = ACTIVATION_RELU6;
+        } else if (strncmp(value, "leaky", 5) == 0) {
+            epilogue->activation = ACTIVATION_LEAKY;
+            epilogue->leaky_slope = 0.01;
+            if (value[5] == ':') {
+                epilogue->leaky_slope = strtod(value + 6, &end);
+                return end != value + 6 && *end == '\0';
             }
+            return value[5] == '\0';
+        } else {
+            return 0;
+        }
+        return 1;
+    }
 
-            printf("\n");
+    if (strcmp(option, "--clamp") == 0) {
+        epilogue->clamp = 1;
+        epilogue->clamp_min = strtod(value, &end);
+        if (end == value || *end != ',') return 0;
+        char* max = end + 1;
+        epilogue->clamp_max = strtod(max, &end);
+        return end != max && *end == '\0' && epilogue->clamp_min <= epilogue->clamp_max;
+    }
+
+    if (strcmp(option, "--requantize") == 0) {
+        epilogue->requantize_bits = 8;
+        epilogue->requantize_scale = strtod(value, &end);
+        if (end == value || epilogue->requantize_scale <= 0) return 0;
+        if (*end == ',') {
+            char* zero_point = end + 1;
+            epilogue->requantize_zero_point = (int)strtol(zero_point, &end, 10);
+            if (end == zero_point) return 0;
         }
-        
+        return *end == '\0';
     }
-    printSimulatorEndMessage();
+
+    if (strcmp(option, "--pool") == 0) {
+        epilogue->pool = atoi(value);
+        return epilogue->pool >= 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse the value of one accelerator option into the configuration
+ * Buffer sizes take an optional K or M suffix
+ *
+ * @param option The option, e.g. --trios
+ * @param value The argument following it
+ * @param config Updated in place
+ * @return 1 on success, 0 if the value is invalid
+ */
+int parse_accel_option(char* option, char* value, accel_config_s* config) {
+    char* end;
+    double number = strtod(value, &end);
+    if (end == value || number <= 0) return 0;
+
+    if (strstr(option, "buffer") != NULL) {
+        if (*end == 'K' || *end == 'k') {
+            number *= 1024;
+            end++;
+        } else if (*end == 'M' || *end == 'm') {
+            number *= 1024 * 1024;
+            end++;
+        }
+    }
+    if (*end != '\0') return 0;
+
+    if (strcmp(option, "--trios") == 0) {
+        config->n_trios = (int)number;
+    } else if (strcmp(option, "--input-buffer") == 0) {
+        config->input_buffer_bytes = (long)number;
+    } else if (strcmp(option, "--weight-buffer") == 0) {
+        config->weight_buffer_bytes = (long)number;
+    } else if (strcmp(option, "--output-buffer") == 0) {
+        config->output_buffer_bytes = (long)number;
+    } else if (strcmp(option, "--dram-bw") == 0) {
+        config->dram_bytes_per_cycle = number;
+    } else if (strcmp(option, "--dram-latency") == 0) {
+        config->dram_latency = (int)number;
+    } else if (strcmp(option, "--clock") == 0) {
+        config->clock_mhz = number;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Debug output after every FCU cycle, enabled by --debug and the DEBUG_INPUT_* flags
+ *
+ * @param results Combined outputs of the FCU trio for the cycle
+ * @param idx Feature map index of the entry y_0 belongs to, y_1 and y_2 follow it
+ */
+void debug_cycle_hook(fcu_outputs_s* results, int idx) {
+    if (DEBUG_FCU_SLIDING_INPUTS) {
+        usleep(sleep_duration);
+        check_fcu_inputs_to_img_pixels(image_pixels);
+        printf("Feature Map IDX: %d (Y0), %d (Y1), %d (Y2)\n", idx, idx +1, idx +2);
+        if (DEBUG_FCU_OUTPUTS) print_fcu_outputs(results, 0, 0, idx);
+    }
+
+    //print the current inputs
+    if (DEBUG_INPUT_ASSIGNEMNT) {
+        printf("\nInput assignments to FCUs\n");
+        for (int i = 0; i < 3; i++) {
+            printf("\tFCU #%d: ", i+1);
+            printf("%.2f\t%.2f\t%.2f\n", (double)storage_to_data(*fcu_array[i]->inputs->x_0),
+                (double)storage_to_data(*fcu_array[i]->inputs->x_1),
+                (double)storage_to_data(*fcu_array[i]->inputs->x_2));
+        }
+        printf("Input assignments to FCUs\n");
+    }
+
+    if (DEBUG_INPUT_SLIDING) {
+
+        printf("\tPixels");
+        printf("\t\tInput set %d", idx);
+        printf("\t\tKernel\n");
+        print_current_input_set();
+    }
+
+    if (DEBUG_STEP_THRU_MODE) {
+        // Manual step-through mode - wait for user input
+        printf("Press Enter to continue...");
+        getchar();
+    }
+}
+
+/**
+ * Map a shape name from the command line to its input file
+ *
+ * @return 1 if the shape is known, 0 otherwise
+ */
+int shape_filename(char* shape, char* filename) {
+    if (strcmp(shape, "square") == 0) {
+        strcpy(filename, "inputs/square.txt");
+    } else if (strcmp(shape, "circle") == 0) {
+        strcpy(filename, "inputs/circle.txt");
+    } else if (strcmp(shape, "triangle") == 0) {
+        strcpy(filename, "inputs/triangle.txt");
+    } else if (strcmp(shape, "pentagon") == 0) {
+        strcpy(filename, "inputs/pentagon.txt");
+    } else if (strcmp(shape, "star") == 0) {
+        strcpy(filename, "inputs/star.txt");
+    } else {
+        return 0;
+    }
+    return 1;
 }
 
+/**
+ * Print the hardware multiply count of the run next to what the other engines
+ * would need for the same number of outputs
+ *
+ * Per output a direct 3x3 needs 9 multiplies, F(2x2, 3x3) 4 (16 per 2x2 tile)
+ * and F(4x4, 3x3) 2.25 (36 per 4x4 tile). The FCU trio runs 18 multiplies a
+ * cycle, its y_0, y_1 and y_2 overlap as the band slides by one column, so
+ * each cycle adds one feature map entry: 18 per output
+ *
+ * @param engine The engine that actually ran
+ * @param multiplies Multiplies counted through multiplier() during the run
+ * @param outputs Feature map entries written by the run
+ */
+void print_multiply_report(conv_engine_e engine, unsigned long long multiplies, long outputs) {
+    const char* names[] = { "FCU (3-parallel FIR)", "Winograd F(2x2,3x3)", "Winograd F(4x4,3x3)" };
+    const double per_output[] = { 18.0, 4.0, 2.25 };
+
+    printf("\n************** Multiplies **************\n");
+    printf("Engine: %s\n", names[engine]);
+    printf("Outputs: %ld\n", outputs);
+    printf("Measured: %llu (%.2f per output)\n", multiplies,
+           outputs > 0 ? (double)multiplies / outputs : 0.0);
+    printf("\nHardware multiplies for %ld outputs\n", outputs);
+    printf("\t%-22s %12.0f\t(9.00 per output)\n", "Direct 3x3", 9.0 * outputs);
+    for (int i = 0; i < 3; i++) {
+        printf("\t%-22s %12.0f\t(%.2f per output)%s\n", names[i], per_output[i] * outputs,
+               per_output[i], i == (int)engine ? " <--" : "");
+    }
+    printf("****************************************\n");
+}
 
 //for each FCU, go through its inputs and see if the address values for the double pointers match any addresses within the image array
-void check_fcu_inputs_to_img_pixels(double* pixels) {
+void check_fcu_inputs_to_img_pixels(fcu_storage_t* pixels) {
 
     if (pixels == NULL) {
         printf("Pixels are NULL\n");
@@ -312,7 +1468,7 @@ void check_fcu_inputs_to_img_pixels(double* pixels) {
                        fcu_array[2]->inputs->x_2 == &pixels[j]) {
                 printf("Z\t");
             } else {
-                printf("%.2f\t", image_pixels[j]);
+                printf("%.2f\t", (double)storage_to_data(image_pixels[j]));
             }
 
         }
@@ -320,96 +1476,26 @@ void check_fcu_inputs_to_img_pixels(double* pixels) {
     }
 }
 
-void generate_feature_map(char* filename, int size) {
+/**
+ * Write one channel of output_feature_map to filename, a line per row
+ *
+ * @param filename Output file
+ * @param layout Shape and storage order of output_feature_map
+ * @param channel Channel to write
+ *
+ * Does nothing with --no-output
+ */
+void generate_feature_map(char* filename, const tensor_layout_s* layout, int channel) {
+    if (!write_outputs) return;
+    TRACE_SCOPE("write feature map");
     FILE* file = fopen(filename, "w");
     if (file == NULL) {
         fprintf(stderr, "Could not create output file\n");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < size * size; i++) {
-        if (i % size == 0) {
-            fprintf(file, "\n");
-        }
-        fprintf(file, "%.2f\t",output_feature_map[i]);
-    }
-
-}
-
-/**
- * Function to shift the inputs to the FCU over by the stride amount
- * 
- * We know when we will reach the end of a row for a FCU by finding the difference in their pointers
- * Since the pixel is stored in contiguous memory
- * 
- * 
- */
-int slide_inputs(fcu_s* fcu) {
-    //find the difference between the addr-of third input and the addr of the first pixel
-    double* third_input = fcu->inputs->x_2;
-    int diff = third_input - image_pixels + 1;
-
-    //reached end of a row
-    if (diff % (image_size) == 0) {
-
-        //need to detect if we've reached the final row set for the entire image
-        if (diff + (image_size*(KERNEL_SIZE-1) + 1) > image_size*image_size) {
-            return 0;
-        }
-
-        //if not reached end, then slide kernel as normal
-        fcu->inputs->x_0 = fcu->inputs->x_0 + KERNEL_SIZE + (image_size*(KERNEL_SIZE-1));
-        fcu->inputs->x_1 = fcu->inputs->x_1 + KERNEL_SIZE + (image_size*(KERNEL_SIZE-1));
-        fcu->inputs->x_2 = fcu->inputs->x_2 + KERNEL_SIZE + (image_size*(KERNEL_SIZE-1));
-
-    } else {
-        // in the middle of a row so slide as normal
-        fcu->inputs->x_0 = fcu->inputs->x_0 + STRIDE;
-        fcu->inputs->x_1 = fcu->inputs->x_1 + STRIDE;
-        fcu->inputs->x_2 = fcu->inputs->x_2 + STRIDE;
-
-        
-    }
-
-    return 1;
-}
-
-//initialize an FCU
-fcu_s* init_fcu(fcu_s* fcu, char* fcu_name) {
-    //create a pointer to a fcu_s structure and assign it to the the value of the pointer passed into the arg
-    fcu = (fcu_s*)malloc(sizeof(fcu_s));
-    
-    if (fcu == NULL) {
-        fprintf(stderr, "Memory allocation failed for FCU\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // init the inpiuts struct
-    (fcu)->inputs = (fcu_inputs_s*)malloc(sizeof(fcu_inputs_s));
-    if ((fcu)->inputs == NULL) {
-        fprintf(stderr, "Memory allocation failed for FCU inputs\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Initialize coefficients
-    (fcu)->h = (fcu_coefficients_s*)malloc(sizeof(fcu_coefficients_s));
-    if ((fcu)->h == NULL) {
-        fprintf(stderr, "Memory allocation failed for FCU coefficients\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Initialize shift regs
-    init_shift_reg(&((fcu)->shift_reg_1), strcat(fcu_name, "_sr_a"));
-    init_shift_reg(&((fcu)->shift_reg_2), strcat(fcu_name, "_sr_b"));
-
-    // Initialize outputs struct
-    (fcu)->outputs = (fcu_outputs_s*)malloc(sizeof(fcu_outputs_s));
-    if ((fcu)->outputs == NULL) {
-        fprintf(stderr, "Memory allocation failed for FCU outputs\n");
-        exit(EXIT_FAILURE);
-    }
-
-    return fcu;
+    write_layout_channel(file, layout, output_feature_map, channel);
+    fclose(file);
 }
 
 /**
@@ -445,7 +1531,7 @@ fcu_s* init_fcu(fcu_s* fcu, char* fcu_name) {
  * Initialize the kernel
  */
 kernel_s* init_kernel(kernel_s* kernel) {
-    kernel = (kernel_s*)malloc(sizeof(kernel_s*));
+    kernel = (kernel_s*)malloc(sizeof(kernel_s));
 
     if (kernel == NULL) {
         fprintf(stderr, "Memory allocation failed for kernel\n");
@@ -513,7 +1599,7 @@ fcu_coefficients_s* init_fcu_coefficients(fcu_coefficients_s* h) {
 }
 
 //print all the pixel data in the image
-void print_image_pixels(double* pixels, int size) {
+void print_image_pixels(fcu_storage_t* pixels, int size) {
 
     
     if (pixels == NULL) {
@@ -525,7 +1611,7 @@ void print_image_pixels(double* pixels, int size) {
         printf("Row %d:\t", i+1 % image_size);
 
         for (int j = i * image_size; j < (i + 1) * image_size; j++) {
-            printf("%.2f\t", image_pixels[j]);
+            printf("%.2f\t", (double)storage_to_data(image_pixels[j]));
         }
 
         printf("\n");
@@ -533,104 +1619,59 @@ void print_image_pixels(double* pixels, int size) {
 }
 
 /**
- * Function that will initialize the testing pixel data with random values
+ * Function that will initialize the pixel data, from a text image or generated
  * 
  * @param size the width of the image in pixels.
- * @param mode For random pixel generation or file input
+ * @param workload Synthetic input to generate, NULL or kind WORKLOAD_NONE to read filename
+ * @param filename Text image to read
+ * @param n_threads Threads generating a synthetic input
  * 
- * Stored as an array that is size^2 long
+ * Stored as an array that is size^2 long, zero padded to a multiple of the stride
  */
-int init_pixel_inputs(int size, int mode, char* filename) {
-    printf("Mode is %d\n", mode);
-    if (mode == 1) {
+int init_pixel_inputs(int size, const workload_s* workload, char* filename, int n_threads) {
+    TRACE_SCOPE("load image");
+    printf("Input is %s\n", filename);
+    printf("Precision is %s\n", FCU_PRECISION_NAME);
+    if (workload != NULL && workload->kind != WORKLOAD_NONE) {
         //first determine an overall image size that is a multiple of the stride value
         int new_size = size;
         while (new_size % STRIDE != 0) {
             new_size = new_size + 1;
         }
 
-        //keep track of how many zeros we need to pad for right align and bottom rown
-        int padding_depth = new_size - size;
-
-        // double* pixels = (double*)malloc(new_size * new_size * sizeof(double));
-        image_pixels = (double*)malloc(new_size * new_size * sizeof(double));
-        double* pixels = image_pixels;
-
-        if (pixels == NULL) {
-            fprintf(stderr, "Memory allocation failed for pixel inputs\n");
-            exit(EXIT_FAILURE);
-        }
-
-        int counter = 0;
-
-        //mod by 255 since pixels are 8-bit values
-        for (int i = 0; i < new_size * new_size; i++) {
-            //mem array is at the right edge of the original sizing
-            if (counter == size) {
-                //add zeros for padding_depth length
-                int x;
-                for (x = i; x < i + padding_depth; x++) {
-                    pixels[x] = 0.0;
-                }
-                //update i to be the correct position in the overall image's memory
-                i = x;
-                counter = 0;
-            }
-            double tmp = (double)(rand() % 255);
-            pixels[i] = tmp == 0 ? (double)(rand() % 255) : tmp;
-            counter = counter + 1;
-        }
+        //the generator zeroes the padding to the right of each row and below the last
+        tensor_layout_s layout = make_tensor_layout(new_size, new_size, 1, 1);
+        image_pixels = alloc_layout(&layout);
+        generate_workload(workload, &layout, image_pixels, 0, size, n_threads);
 
         return new_size;
-    } else if (mode == 0) {
-        //open file ptr in read mode
-        FILE* file = fopen(filename, "r");
-
-        if (file == NULL) {
-            fprintf(stderr, "Could not open input file\n");
-            exit(EXIT_FAILURE);
-        }
+    } else {
+        pixel_reader_s* reader = open_pixel_reader(filename);
 
         int new_size = size;
         while (new_size % STRIDE != 0) {
             new_size = new_size + 1;
         }
 
-        //keep track of how many zeros we need to pad for right align and bottom rown
-        int padding_depth = new_size - size;
-
-
-        image_pixels = (double*)malloc(new_size * new_size * sizeof(double));
+        image_pixels = (fcu_storage_t*)malloc(new_size * new_size * sizeof(fcu_storage_t));
 
         if (image_pixels == NULL) {
             fprintf(stderr, "Memory allocation failed for pixel inputs\n");
             exit(EXIT_FAILURE);
         }
-        int counter = 0;
-        for (int i = 0; i < new_size * new_size; i++) {
-            
-            if (counter == size) {
-                //add zeros for padding_depth length
-                int x;
-                for (x = i; x < i + padding_depth; x++) {
-                    image_pixels[x] = 0.0;
-                }
-                i = x;
-                counter = 0;
+        //one file row at a time, zeros to the right of each row and below the last
+        for (int row = 0; row < new_size; row++) {
+            fcu_storage_t* pixels = image_pixels + row * new_size;
+            int read = row < size ? read_pixels(reader, pixels, size) : 0;
+            for (int x = read; x < new_size; x++) {
+                pixels[x] = data_to_storage(0.0);
             }
-            
-            fscanf(file, "%lf", &image_pixels[i]);
-            
-            counter = counter+1;
         }
-        
-        fclose(file);
+
+        //stops the run if the file is not size x size
+        close_pixel_reader(reader, size);
         return new_size;
-    } else {
-        fprintf(stderr, "Invalid mode for pixel input initialization\n");
-        exit(EXIT_FAILURE);
     }
-
 }
 
 
@@ -720,9 +1761,9 @@ void print_current_input_set() {
     if (fcu_array == NULL) return;
 
     //print first row inputs
-    printf("%.2f\t", *(fcu_array[0]->inputs->x_0));
-    printf("%.2f\t", *(fcu_array[0]->inputs->x_1));
-    printf("%.2f\t", *(fcu_array[0]->inputs->x_2));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[0]->inputs->x_0));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[0]->inputs->x_1));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[0]->inputs->x_2));
     
     printf("\t\t");
 
@@ -734,9 +1775,9 @@ void print_current_input_set() {
     printf("\n");
     
     //print second row inputs
-    printf("%.2f\t", *(fcu_array[1]->inputs->x_0));
-    printf("%.2f\t", *(fcu_array[1]->inputs->x_1));
-    printf("%.2f\t", *(fcu_array[1]->inputs->x_2));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[1]->inputs->x_0));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[1]->inputs->x_1));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[1]->inputs->x_2));
     
     printf("\t*\t");
     
@@ -748,9 +1789,9 @@ void print_current_input_set() {
     printf("\n");
 
     //print third row inputs
-    printf("%.2f\t", *(fcu_array[2]->inputs->x_0));
-    printf("%.2f\t", *(fcu_array[2]->inputs->x_1));
-    printf("%.2f\t", *(fcu_array[2]->inputs->x_2));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[2]->inputs->x_0));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[2]->inputs->x_1));
+    printf("%.2f\t", (double)storage_to_data(*fcu_array[2]->inputs->x_2));
     
     printf("\t\t");
 
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sparse.h"
+#include "engine.h"
+
+static int chunk_occupied(occupancy_map_s* map, int band, int chunk) {
+    uint64_t word = map->bits[band * map->words_per_band + chunk / 64];
+    return (word >> (chunk % 64)) & 1;
+}
+
+//a window is empty when every chunk it touches is empty
+static int window_is_zero(occupancy_map_s* map, int band, int t) {
+    return !chunk_occupied(map, band, t / ZERO_SKIP_CHUNK) &&
+           !chunk_occupied(map, band, (t + KERNEL_SIZE - 1) / ZERO_SKIP_CHUNK);
+}
+
+/**
+ * First window at or after the start of the next occupied chunk
+ * Returns the end of the band if the rest of it is empty
+ */
+static int next_window_with_data(occupancy_map_s* map, int band, int t) {
+    int last_window = map->width - KERNEL_SIZE + 1;
+    int chunks = (map->width + ZERO_SKIP_CHUNK - 1) / ZERO_SKIP_CHUNK;
+    int chunk = (t + KERNEL_SIZE - 1) / ZERO_SKIP_CHUNK + 1;
+
+    while (chunk < chunks) {
+        uint64_t word = map->bits[band * map->words_per_band + chunk / 64] >> (chunk % 64);
+        if (word != 0) {
+            chunk += __builtin_ctzll(word);
+            break;
+        }
+        chunk += 64 - (chunk % 64);
+    }
+    if (chunk >= chunks) return last_window;
+
+    //the first window that reaches into the chunk
+    int next = chunk * ZERO_SKIP_CHUNK - (KERNEL_SIZE - 1);
+    return next < last_window ? next : last_window;
+}
+
+/**
+ * Build the occupancy bitmap for a width x width image
+ * Also clears the zero run, so build a new map for every image
+ */
+occupancy_map_s* init_occupancy_map(occupancy_map_s* map, fcu_storage_t* pixels, int width) {
+    map = (occupancy_map_s*)malloc(sizeof(occupancy_map_s));
+    if (map == NULL) {
+        fprintf(stderr, "Memory allocation failed for occupancy map\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(map, 0, sizeof(occupancy_map_s));
+
+    int chunks = (width + ZERO_SKIP_CHUNK - 1) / ZERO_SKIP_CHUNK;
+    map->width = width;
+    map->bands = width / KERNEL_SIZE;
+    map->words_per_band = (chunks + 63) / 64;
+    map->bits = (uint64_t*)calloc(map->bands * map->words_per_band, sizeof(uint64_t));
+    if (map->bits == NULL) {
+        fprintf(stderr, "Memory allocation failed for occupancy bits\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int band = 0; band < map->bands; band++) {
+        uint64_t* words = map->bits + band * map->words_per_band;
+        for (int r = 0; r < KERNEL_SIZE; r++) {
+            fcu_storage_t* row = pixels + (band * KERNEL_SIZE + r) * width;
+            for (int col = 0; col < width; col++) {
+                if (storage_to_data(row[col]) != 0.0) {
+                    int chunk = col / ZERO_SKIP_CHUNK;
+                    words[chunk / 64] |= (uint64_t)1 << (chunk % 64);
+                }
+            }
+        }
+    }
+
+    return map;
+}
+
+/**
+ * Same as fcu_convolve_band() but skips runs of all-zero windows
+ *
+ * An all-zero window only feeds zeros into the shift registers, so after three
+ * of them in a row the registers hold exactly what any further zero windows
+ * would leave behind, and every output column a skipped cycle would have
+ * written belongs to one of those zero windows. From there the trio jumps
+ * straight to the first window that touches an occupied chunk.
+ * The zero run is kept in the map because the registers carry across bands
+ *
+ * @param map Occupancy map of the image
+ * @param fcus The FCU trio, kernel rows already assigned
+ * @param band Band number, rows band * KERNEL_SIZE onwards
+ * @param rows First pixel of the band
+ * @param out Column 0 of the band's output row
+ * @param stride Elements between output columns, the block size of the layout
+ * @return Number of FCU cycles actually run
+ */
+int fcu_convolve_band_sparse(occupancy_map_s* map, fcu_s** fcus, int band, fcu_storage_t* rows, fcu_storage_t* out,
+                             int stride) {
+    fcu_outputs_s results;
+    int cycles = 0;
+    int last = map->width - KERNEL_SIZE;
+
+    for (int t = 0; t <= last; ) {
+        if (window_is_zero(map, band, t)) {
+            if (map->zero_run >= 3) {
+                int next = next_window_with_data(map, band, t);
+                map->cycles_skipped += next - t;
+                t = next;
+                continue;
+            }
+            map->zero_run++;
+        } else {
+            map->zero_run = 0;
+        }
+
+        fcu_trio_cycle(fcus, rows + t, map->width, &results);
+        store_fcu_outputs(out, stride, t, last, &results);
+        cycles++;
+        t += STRIDE;
+    }
+
+    map->cycles_run += cycles;
+    return cycles;
+}
+
+void free_occupancy_map(occupancy_map_s* map) {
+    free(map->bits);
+    free(map);
+}
@@ -0,0 +1,32 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdint.h>
+
+#include "fcu.h"
+
+//columns covered by one occupancy bit
+#define ZERO_SKIP_CHUNK 8
+
+/**
+ * Coarse occupancy bitmap of an image, built once at load time
+ *
+ * Bit k of a band is set if any pixel in the band's KERNEL_SIZE rows and
+ * columns [k * ZERO_SKIP_CHUNK, (k + 1) * ZERO_SKIP_CHUNK) is non-zero
+ */
+typedef struct {
+    int width;
+    int bands;
+    int words_per_band;
+    uint64_t* bits;
+    int zero_run;           //consecutive all-zero cycles fed to the trio so far
+    long cycles_run;
+    long cycles_skipped;
+} occupancy_map_s;
+
+occupancy_map_s* init_occupancy_map(occupancy_map_s* map, fcu_storage_t* pixels, int width);
+int fcu_convolve_band_sparse(occupancy_map_s* map, fcu_s** fcus, int band, fcu_storage_t* rows, fcu_storage_t* out,
+                             int stride);
+void free_occupancy_map(occupancy_map_s* map);
+
+#endif
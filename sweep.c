@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sweep.h"
+#include "trace.h"
+
+/**
+ * Design space sweep over the accelerator model
+ *
+ * Every combination of the swept values is one point. Points are split into
+ * one contiguous range per worker; a worker that runs out steals the back
+ * half of another worker's range. Rows are appended to the CSV as points
+ * finish, and the CSV doubles as the cache: points whose configuration
+ * columns are already in it are skipped, so an interrupted or extended sweep
+ * only runs what is missing
+ */
+
+static const char* SWEEP_NAMES[SWEEP_PARAMS] = {
+    "trios", "kernel", "stride", "input-buffer", "weight-buffer", "output-buffer",
+    "precision", "dram-bw", "dram-latency"
+};
+
+//configuration columns, then the results
+#define SWEEP_KEY_COLUMNS 13
+static const char* SWEEP_CSV_HEADER =
+    "size,channels,filters,groups,kernel,stride,trios,input_buffer,weight_buffer,output_buffer,"
+    "element_bytes,dram_bw,dram_latency,status,cycles,latency_ms,macs_per_cycle,gmacs,utilization,"
+    "input_stall,output_stall,idle,dram_input,dram_weight,dram_output\n";
+
+typedef struct {
+    char** keys;            //open addressing, NULL for empty
+    long* cycles;
+    long capacity;          //power of two
+    long count;
+} sweep_cache_s;
+
+//range of points a worker still has to run
+typedef struct {
+    pthread_mutex_t lock;
+    long head;
+    long tail;
+} sweep_range_s;
+
+typedef struct sweep_run_s sweep_run_s;
+
+typedef struct {
+    sweep_run_s* run;
+    int id;
+    long cached;
+    long run_points;
+    long invalid;
+    long steals;
+} sweep_worker_s;
+
+struct sweep_run_s {
+    sweep_spec_s* sweep;
+    const accel_config_s* base_config;
+    const accel_layer_s* base_layer;
+    sweep_cache_s* cache;
+    sweep_range_s* ranges;
+    int n_workers;
+    FILE* csv;
+    pthread_mutex_t csv_lock;
+    sweep_stats_s* stats;
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t hash_key(const char* key) {
+    uint64_t hash = FNV_OFFSET;
+    for (; *key != '\0'; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void cache_insert(sweep_cache_s* cache, const char* key, long cycles);
+
+static void cache_grow(sweep_cache_s* cache) {
+    char** old_keys = cache->keys;
+    long* old_cycles = cache->cycles;
+    long old_capacity = cache->capacity;
+
+    cache->capacity = old_capacity == 0 ? 1024 : old_capacity * 2;
+    cache->keys = (char**)calloc(cache->capacity, sizeof(char*));
+    cache->cycles = (long*)malloc(cache->capacity * sizeof(long));
+    if (cache->keys == NULL || cache->cycles == NULL) {
+        fprintf(stderr, "Memory allocation failed for sweep cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cache->count = 0;
+    for (long i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != NULL) {
+            cache_insert(cache, old_keys[i], old_cycles[i]);
+            free(old_keys[i]);
+        }
+    }
+    free(old_keys);
+    free(old_cycles);
+}
+
+static void cache_insert(sweep_cache_s* cache, const char* key, long cycles) {
+    if (2 * (cache->count + 1) > cache->capacity) cache_grow(cache);
+
+    long i = hash_key(key) & (cache->capacity - 1);
+    while (cache->keys[i] != NULL) {
+        if (strcmp(cache->keys[i], key) == 0) {
+            cache->cycles[i] = cycles;
+            return;
+        }
+        i = (i + 1) & (cache->capacity - 1);
+    }
+    cache->keys[i] = strdup(key);
+    cache->cycles[i] = cycles;
+    cache->count++;
+}
+
+//cycles of a cached point, -2 if it is not in the cache
+static long cache_lookup(sweep_cache_s* cache, const char* key) {
+    if (cache->capacity == 0) return -2;
+    long i = hash_key(key) & (cache->capacity - 1);
+    while (cache->keys[i] != NULL) {
+        if (strcmp(cache->keys[i], key) == 0) return cache->cycles[i];
+        i = (i + 1) & (cache->capacity - 1);
+    }
+    return -2;
+}
+
+//rows of an earlier run, keyed by their configuration columns
+static void load_cache(sweep_cache_s* cache, char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "size,", 5) == 0) continue;
+
+        //cut the line after the configuration columns, status and cycles follow
+        char* p = line;
+        for (int column = 0; column < SWEEP_KEY_COLUMNS && p != NULL; column++) {
+            p = strchr(p, ',');
+            if (p != NULL) p++;
+        }
+        if (p == NULL) continue;
+        p[-1] = '\0';
+
+        char* cycles = strchr(p, ',');
+        cache_insert(cache, line, cycles != NULL && strncmp(p, "ok,", 3) == 0 ? atol(cycles + 1) : -1);
+    }
+    fclose(file);
+}
+
+static void free_cache(sweep_cache_s* cache) {
+    for (long i = 0; i < cache->capacity; i++) free(cache->keys[i]);
+    free(cache->keys);
+    free(cache->cycles);
+}
+
+//one value with an optional K / M suffix, precision also takes a format name
+static int parse_value(int param, char* text, double* value) {
+    if (param == SWEEP_PRECISION) {
+        if (strcmp(text, "fp64") == 0 || strcmp(text, "double") == 0) { *value = 8; return 1; }
+        if (strcmp(text, "fp32") == 0 || strcmp(text, "float") == 0) { *value = 4; return 1; }
+        if (strcmp(text, "fp16") == 0 || strcmp(text, "bf16") == 0) { *value = 2; return 1; }
+    }
+
+    char* end;
+    *value = strtod(text, &end);
+    if (end == text) return 0;
+    if (*end == 'K' || *end == 'k') {
+        *value *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        *value *= 1024 * 1024;
+        end++;
+    }
+    return *end == '\0' && *value > 0;
+}
+
+/**
+ * Comma separated values, each a single value or a range lo:hi (step 1),
+ * lo:hi:step or lo:hi:xfactor
+ */
+static int parse_values(int param, char* text, sweep_spec_s* sweep) {
+    char* save;
+    for (char* item = strtok_r(text, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char* parts[3] = {item, NULL, NULL};
+        int n_parts = 1;
+        for (char* c = item; *c != '\0' && n_parts < 3; c++) {
+            if (*c == ':') {
+                *c = '\0';
+                parts[n_parts++] = c + 1;
+            }
+        }
+
+        double lo, hi, step = 1;
+        int geometric = 0;
+        if (!parse_value(param, parts[0], &lo)) return 0;
+        hi = lo;
+        if (n_parts > 1 && !parse_value(param, parts[1], &hi)) return 0;
+        if (n_parts > 2) {
+            geometric = parts[2][0] == 'x';
+            if (!parse_value(param, parts[2] + geometric, &step)) return 0;
+            if (geometric && step <= 1) return 0;
+        }
+
+        for (double v = lo; v <= hi * (1 + 1e-9); v = geometric ? v * step : v + step) {
+            //repeats would run the same point twice, e.g. fp16 and bf16 are both 2 bytes to the model
+            int repeat = 0;
+            for (int i = 0; i < sweep->n_values[param]; i++) {
+                if (sweep->values[param][i] == v) repeat = 1;
+            }
+            if (repeat) continue;
+            if (sweep->n_values[param] == SWEEP_MAX_VALUES) return 0;
+            sweep->values[param][sweep->n_values[param]++] = v;
+        }
+    }
+    return sweep->n_values[param] > 0;
+}
+
+/**
+ * Parse a sweep such as "trios=1:16:x2;input-buffer=8K,64K;precision=fp32,fp16"
+ *
+ * @param spec Parameters separated by ';', see SWEEP_NAMES
+ * @param sweep Filled with the values of each parameter
+ * @return 1 on success, 0 if the spec is invalid
+ */
+int parse_sweep_spec(char* spec, sweep_spec_s* sweep) {
+    memset(sweep, 0, sizeof(sweep_spec_s));
+    char* copy = strdup(spec);
+    char* save;
+    int ok = 1;
+
+    for (char* item = strtok_r(copy, ";", &save); item != NULL && ok; item = strtok_r(NULL, ";", &save)) {
+        char* equals = strchr(item, '=');
+        if (equals == NULL) {
+            ok = 0;
+            break;
+        }
+        *equals = '\0';
+
+        int param;
+        for (param = 0; param < SWEEP_PARAMS; param++) {
+            if (strcmp(item, SWEEP_NAMES[param]) == 0) break;
+        }
+        if (param == SWEEP_PARAMS) {
+            fprintf(stderr, "Unknown sweep parameter %s\n", item);
+            ok = 0;
+            break;
+        }
+        ok = parse_values(param, equals + 1, sweep);
+    }
+
+    free(copy);
+    return ok;
+}
+
+//decode a point index into its configuration, mixed radix over the parameters
+static void point_config(sweep_run_s* run, long point, accel_config_s* config, accel_layer_s* layer) {
+    *config = *run->base_config;
+    *layer = *run->base_layer;
+
+    for (int param = 0; param < SWEEP_PARAMS; param++) {
+        int n = run->sweep->n_values[param];
+        if (n == 0) continue;
+        double v = run->sweep->values[param][point % n];
+        point /= n;
+
+        switch (param) {
+            case SWEEP_TRIOS: config->n_trios = (int)v; break;
+            case SWEEP_KERNEL: layer->kernel_size = (int)v; break;
+            case SWEEP_STRIDE: layer->stride = (int)v; break;
+            case SWEEP_INPUT_BUFFER: config->input_buffer_bytes = (long)v; break;
+            case SWEEP_WEIGHT_BUFFER: config->weight_buffer_bytes = (long)v; break;
+            case SWEEP_OUTPUT_BUFFER: config->output_buffer_bytes = (long)v; break;
+            case SWEEP_PRECISION: config->element_bytes = (int)v; break;
+            case SWEEP_DRAM_BW: config->dram_bytes_per_cycle = v; break;
+            case SWEEP_DRAM_LATENCY: config->dram_latency = (int)v; break;
+        }
+    }
+}
+
+static void format_key(char* key, size_t size, const accel_config_s* config, const accel_layer_s* layer) {
+    snprintf(key, size, "%d,%d,%d,%d,%d,%d,%d,%ld,%ld,%ld,%d,%g,%d",
+             layer->size, layer->channels, layer->filters, layer->groups, layer->kernel_size, layer->stride,
+             config->n_trios, config->input_buffer_bytes, config->weight_buffer_bytes,
+             config->output_buffer_bytes, config->element_bytes, config->dram_bytes_per_cycle,
+             config->dram_latency);
+}
+
+//next point for this worker, stealing half of another range once its own is empty
+static long next_point(sweep_worker_s* worker) {
+    sweep_run_s* run = worker->run;
+    sweep_range_s* own = &run->ranges[worker->id];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        long point = own->head++;
+        pthread_mutex_unlock(&own->lock);
+        return point;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < run->n_workers; i++) {
+        sweep_range_s* victim = &run->ranges[(worker->id + i) % run->n_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        long left = victim->tail - victim->head;
+        if (left < 1) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        long take = (left + 1) / 2;
+        long first = victim->tail - take;
+        victim->tail = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        worker->steals++;
+        pthread_mutex_lock(&own->lock);
+        own->head = first + 1;
+        own->tail = first + take;
+        pthread_mutex_unlock(&own->lock);
+        return first;
+    }
+    return -1;
+}
+
+//keep the fastest valid point of this sweep, called under csv_lock
+static void record_best(sweep_stats_s* stats, long cycles, const char* key) {
+    if (cycles < 0 || (stats->best_cycles >= 0 && cycles >= stats->best_cycles)) return;
+    stats->best_cycles = cycles;
+    snprintf(stats->best_key, sizeof(stats->best_key), "%s", key);
+}
+
+static void* sweep_worker(void* arg) {
+    sweep_worker_s* worker = (sweep_worker_s*)arg;
+    sweep_run_s* run = worker->run;
+    char key[256];
+    char row[1024];
+
+    for (long point = next_point(worker); point >= 0; point = next_point(worker)) {
+        accel_config_s config;
+        accel_layer_s layer;
+        point_config(run, point, &config, &layer);
+        format_key(key, sizeof(key), &config, &layer);
+
+        //the cache is only written before the workers start, a hit still counts towards the best
+        long cycles = cache_lookup(run->cache, key);
+        if (cycles != -2) {
+            worker->cached++;
+            pthread_mutex_lock(&run->csv_lock);
+            record_best(run->stats, cycles, key);
+            pthread_mutex_unlock(&run->csv_lock);
+            continue;
+        }
+
+        cycles = -1;
+        const char* error = accel_config_error(&config, &layer);
+        if (error != NULL) {
+            //reasons have no commas, so they go in the status column as they are
+            snprintf(row, sizeof(row), "%s,%s,,,,,,,,,,,\n", key, error);
+            worker->invalid++;
+        } else {
+            accel_report_s report;
+            simulate_accelerator(&config, &layer, &report);
+            long trio_cycles = report.cycles * config.n_trios;
+            cycles = report.cycles;
+            snprintf(row, sizeof(row), "%s,ok,%ld,%.6f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%ld,%ld,%ld\n",
+                     key, report.cycles, report.cycles / (config.clock_mhz * 1e3), report.macs_per_cycle,
+                     report.macs_per_cycle * config.clock_mhz / 1e3, report.utilization,
+                     trio_cycles > 0 ? (double)report.input_stall_cycles / trio_cycles : 0.0,
+                     trio_cycles > 0 ? (double)report.output_stall_cycles / trio_cycles : 0.0,
+                     trio_cycles > 0 ? (double)report.idle_cycles / trio_cycles : 0.0,
+                     report.dram_input_bytes, report.dram_weight_bytes, report.dram_output_bytes);
+        }
+        worker->run_points++;
+
+        pthread_mutex_lock(&run->csv_lock);
+        fputs(row, run->csv);
+        record_best(run->stats, cycles, key);
+        pthread_mutex_unlock(&run->csv_lock);
+    }
+    return NULL;
+}
+
+/**
+ * Run every point of the sweep that is not in the CSV yet
+ *
+ * @param sweep Swept values from parse_sweep_spec()
+ * @param base_config Values of the parameters that are not swept
+ * @param base_layer Layer shape, kernel and stride unless swept
+ * @param csv_filename Results are appended here, earlier rows are the cache
+ * @param n_threads Worker threads
+ * @param stats Point counts, wall time and the fastest configuration
+ */
+void run_sweep(sweep_spec_s* sweep, const accel_config_s* base_config, const accel_layer_s* base_layer,
+               char* csv_filename, int n_threads, sweep_stats_s* stats) {
+    double start = now_seconds();
+    memset(stats, 0, sizeof(sweep_stats_s));
+    stats->best_cycles = -1;
+
+    stats->points = 1;
+    for (int param = 0; param < SWEEP_PARAMS; param++) {
+        if (sweep->n_values[param] > 0) stats->points *= sweep->n_values[param];
+    }
+
+    sweep_cache_s cache;
+    memset(&cache, 0, sizeof(sweep_cache_s));
+    load_cache(&cache, csv_filename);
+
+    sweep_run_s run;
+    run.sweep = sweep;
+    run.base_config = base_config;
+    run.base_layer = base_layer;
+    run.cache = &cache;
+    run.stats = stats;
+    run.csv = fopen(csv_filename, "a");
+    if (run.csv == NULL) {
+        fprintf(stderr, "Could not open sweep output %s\n", csv_filename);
+        exit(EXIT_FAILURE);
+    }
+    if (ftell(run.csv) == 0) fputs(SWEEP_CSV_HEADER, run.csv);
+    pthread_mutex_init(&run.csv_lock, NULL);
+
+    if (n_threads > stats->points) n_threads = (int)stats->points;
+    if (n_threads < 1) n_threads = 1;
+    run.n_workers = n_threads;
+
+    run.ranges = (sweep_range_s*)malloc(n_threads * sizeof(sweep_range_s));
+    sweep_worker_s* workers = (sweep_worker_s*)calloc(n_threads, sizeof(sweep_worker_s));
+    pthread_t* threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (run.ranges == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed for sweep workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        pthread_mutex_init(&run.ranges[t].lock, NULL);
+        run.ranges[t].head = stats->points * t / n_threads;
+        run.ranges[t].tail = stats->points * (t + 1) / n_threads;
+        workers[t].run = &run;
+        workers[t].id = t;
+    }
+    for (int t = 0; t < n_threads; t++) {
+        if (pthread_create(&threads[t], NULL, sweep_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Could not start sweep worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        pthread_join(threads[t], NULL);
+        stats->cached += workers[t].cached;
+        stats->run += workers[t].run_points;
+        stats->invalid += workers[t].invalid;
+        stats->steals += workers[t].steals;
+        pthread_mutex_destroy(&run.ranges[t].lock);
+    }
+
+    fclose(run.csv);
+    pthread_mutex_destroy(&run.csv_lock);
+    free(run.ranges);
+    free(workers);
+    free(threads);
+    free_cache(&cache);
+
+    stats->wall_seconds = now_seconds() - start;
+}
@@ -0,0 +1,48 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <pthread.h>
+
+#include "accel.h"
+
+//values one parameter can take in a sweep
+#define SWEEP_MAX_VALUES 64
+
+typedef enum {
+    SWEEP_TRIOS,
+    SWEEP_KERNEL,
+    SWEEP_STRIDE,
+    SWEEP_INPUT_BUFFER,
+    SWEEP_WEIGHT_BUFFER,
+    SWEEP_OUTPUT_BUFFER,
+    SWEEP_PRECISION,
+    SWEEP_DRAM_BW,
+    SWEEP_DRAM_LATENCY,
+    SWEEP_PARAMS
+} sweep_param_e;
+
+/**
+ * Values of every swept parameter, parameters that are not given keep the
+ * single value of the base configuration
+ */
+typedef struct {
+    double values[SWEEP_PARAMS][SWEEP_MAX_VALUES];
+    int n_values[SWEEP_PARAMS];
+} sweep_spec_s;
+
+typedef struct {
+    long points;
+    long cached;            //points found in the CSV from an earlier run
+    long run;
+    long invalid;           //points the configuration cannot run
+    long steals;
+    double wall_seconds;
+    long best_cycles;       //fewest cycles among the valid points run or cached, -1 if none
+    char best_key[256];     //configuration columns of that point
+} sweep_stats_s;
+
+int parse_sweep_spec(char* spec, sweep_spec_s* sweep);
+void run_sweep(sweep_spec_s* sweep, const accel_config_s* base_config, const accel_layer_s* base_layer,
+               char* csv_filename, int n_threads, sweep_stats_s* stats);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "temporal.h"
+#include "engine.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+//FNV-1a over the raw bytes of n stored pixels
+static uint64_t hash_pixels(uint64_t hash, fcu_storage_t* pixels, int n) {
+    unsigned char* bytes = (unsigned char*)pixels;
+    for (size_t i = 0; i < n * sizeof(fcu_storage_t); i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Hash everything a tile's outputs depend on: the KERNEL_SIZE rows of its own
+ * windows plus the three windows before it. The first tile of a band takes
+ * its halo from the end of the previous band, since the shift registers carry
+ * over when the kernel wraps
+ */
+static uint64_t tile_key(temporal_cache_s* cache, fcu_storage_t* pixels, int band, int t0, int t1) {
+    int width = cache->width;
+    uint64_t hash = FNV_OFFSET;
+
+    int first_col = t0 >= 3 ? t0 - 3 : 0;
+    int last_col = t1 + KERNEL_SIZE - 1;
+    for (int r = 0; r < KERNEL_SIZE; r++) {
+        fcu_storage_t* row = pixels + (band * KERNEL_SIZE + r) * width;
+        hash = hash_pixels(hash, row + first_col, last_col - first_col);
+    }
+
+    if (t0 == 0 && band > 0) {
+        for (int r = 0; r < KERNEL_SIZE; r++) {
+            fcu_storage_t* row = pixels + ((band - 1) * KERNEL_SIZE + r) * width;
+            hash = hash_pixels(hash, row + width - 5, 5);
+        }
+    }
+    return hash;
+}
+
+/**
+ * Set up an empty cache for frames of the given width
+ */
+temporal_cache_s* init_temporal_cache(temporal_cache_s* cache, int width) {
+    cache = (temporal_cache_s*)malloc(sizeof(temporal_cache_s));
+    if (cache == NULL) {
+        fprintf(stderr, "Memory allocation failed for temporal cache\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(cache, 0, sizeof(temporal_cache_s));
+
+    cache->width = width;
+    cache->bands = width / KERNEL_SIZE;
+    cache->cycles_per_band = width - KERNEL_SIZE + 1;
+    cache->tiles_per_band = (cache->cycles_per_band + TEMPORAL_TILE_CYCLES - 1) / TEMPORAL_TILE_CYCLES;
+
+    int tiles = cache->bands * cache->tiles_per_band;
+    cache->keys = (uint64_t*)malloc(tiles * sizeof(uint64_t));
+    cache->outputs = (fcu_outputs_s*)malloc(tiles * TEMPORAL_TILE_CYCLES * sizeof(fcu_outputs_s));
+    cache->state = (fcu_data_t*)malloc(tiles * FCU_TRIO_STATE_SIZE * sizeof(fcu_data_t));
+    if (cache->keys == NULL || cache->outputs == NULL || cache->state == NULL) {
+        fprintf(stderr, "Memory allocation failed for temporal cache tiles\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return cache;
+}
+
+/**
+ * Convolve one frame of a sequence, recomputing only tiles whose inputs or
+ * halo changed since the previous frame
+ *
+ * Produces the same feature map as running the FCU trio over every band
+ *
+ * @param cache Cache from init_temporal_cache(), updated in place
+ * @param fcus The FCU trio, kernel rows already assigned
+ * @param pixels The frame, width x width
+ * @param out Zeroed dense feature map, one row of cycles_per_band columns per band
+ * @return Number of FCU cycles actually run
+ */
+long temporal_convolve_frame(temporal_cache_s* cache, fcu_s** fcus, fcu_storage_t* pixels, fcu_storage_t* out) {
+    int width = cache->width;
+    long cycles = 0;
+
+    reset_fcu_trio(fcus);
+
+    for (int band = 0; band < cache->bands; band++) {
+        fcu_storage_t* rows = pixels + band * KERNEL_SIZE * width;
+
+        for (int tile = 0; tile < cache->tiles_per_band; tile++) {
+            int idx = band * cache->tiles_per_band + tile;
+            int t0 = tile * TEMPORAL_TILE_CYCLES;
+            int t1 = t0 + TEMPORAL_TILE_CYCLES;
+            if (t1 > cache->cycles_per_band) t1 = cache->cycles_per_band;
+
+            fcu_outputs_s* tile_outputs = cache->outputs + idx * TEMPORAL_TILE_CYCLES;
+            fcu_data_t* tile_state = cache->state + idx * FCU_TRIO_STATE_SIZE;
+            uint64_t key = tile_key(cache, pixels, band, t0, t1);
+
+            if (cache->valid && cache->keys[idx] == key) {
+                //same inputs as last frame, pick up where that tile left the registers
+                load_fcu_trio_state(fcus, tile_state);
+                cache->tiles_reused++;
+            } else {
+                for (int t = t0; t < t1; t += STRIDE) {
+                    fcu_trio_cycle(fcus, rows + t, width, &tile_outputs[t - t0]);
+                    cycles++;
+                }
+                save_fcu_trio_state(fcus, tile_state);
+                cache->keys[idx] = key;
+                cache->tiles_computed++;
+            }
+
+            for (int t = t0; t < t1; t += STRIDE) {
+                store_fcu_outputs(out + band * cache->cycles_per_band, 1, t, cache->cycles_per_band - 1,
+                                  &tile_outputs[t - t0]);
+            }
+        }
+    }
+
+    cache->valid = 1;
+    return cycles;
+}
+
+void free_temporal_cache(temporal_cache_s* cache) {
+    free(cache->keys);
+    free(cache->outputs);
+    free(cache->state);
+    free(cache);
+}
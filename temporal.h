@@ -0,0 +1,38 @@
+#ifndef TEMPORAL_H
+#define TEMPORAL_H
+
+#include <stdint.h>
+
+#include "fcu.h"
+
+//FCU cycles per cached tile, at least 3 so a tile's halo never spans two tiles
+#define TEMPORAL_TILE_CYCLES 16
+
+/**
+ * Per-tile cache that lets a frame sequence skip tiles that did not change
+ *
+ * A tile is a run of consecutive FCU cycles within one band. The FCU outputs
+ * of a cycle depend on its 3x3 window and, through the shift registers, on
+ * the three cycles before it. A tile's key therefore hashes its own windows
+ * plus a three cycle halo. When the key matches the previous frame, the cached
+ * outputs are reused and the shift registers are restored to the state the
+ * tile left them in, so the next recomputed tile sees exactly the same state
+ */
+typedef struct {
+    int width;              //image width in pixels
+    int bands;              //bands of KERNEL_SIZE rows per frame
+    int cycles_per_band;    //FCU cycles to cross one band
+    int tiles_per_band;
+    int valid;              //set once a frame has filled the cache
+    uint64_t* keys;         //per tile input hash
+    fcu_outputs_s* outputs; //per tile combined outputs, TEMPORAL_TILE_CYCLES each
+    fcu_data_t* state;      //per tile shift register state at the end of the tile
+    long tiles_computed;
+    long tiles_reused;
+} temporal_cache_s;
+
+temporal_cache_s* init_temporal_cache(temporal_cache_s* cache, int width);
+long temporal_convolve_frame(temporal_cache_s* cache, fcu_s** fcus, fcu_storage_t* pixels, fcu_storage_t* out);
+void free_temporal_cache(temporal_cache_s* cache);
+
+#endif
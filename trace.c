@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+/**
+ * Event ring of one thread
+ *
+ * Only the owning thread writes to it, so recording takes no lock. The rings
+ * are read after the traced threads have been joined
+ */
+typedef struct trace_ring_s {
+    const char* thread_name;
+    int tid;
+    unsigned long written;          //total events recorded, may exceed TRACE_RING_EVENTS
+    trace_event_s* events;
+    struct trace_ring_s* next;
+} trace_ring_s;
+
+typedef struct {
+    const char* name;
+    long count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} trace_totals_s;
+
+int trace_enabled = 0;
+
+static _Thread_local trace_ring_s* thread_ring = NULL;
+static trace_ring_s* rings = NULL;
+static int n_rings = 0;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_epoch = 0;
+static uint64_t trace_end_time = 0;
+
+uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//the same monotonic clock in seconds, for the wall and busy times the modes report
+double now_seconds() {
+    return trace_now() / 1e9;
+}
+
+//the calling thread's ring, created and registered on first use
+static trace_ring_s* get_thread_ring() {
+    if (thread_ring != NULL) return thread_ring;
+
+    trace_ring_s* ring = (trace_ring_s*)calloc(1, sizeof(trace_ring_s));
+    if (ring == NULL) {
+        fprintf(stderr, "Memory allocation failed for trace ring\n");
+        exit(EXIT_FAILURE);
+    }
+    ring->events = (trace_event_s*)malloc(TRACE_RING_EVENTS * sizeof(trace_event_s));
+    if (ring->events == NULL) {
+        fprintf(stderr, "Memory allocation failed for trace events\n");
+        exit(EXIT_FAILURE);
+    }
+    ring->thread_name = "thread";
+
+    pthread_mutex_lock(&rings_lock);
+    ring->tid = n_rings++;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * Turn tracing on, scopes entered from now on are recorded
+ */
+void trace_start() {
+    trace_epoch = trace_now();
+    trace_enabled = 1;
+    trace_thread_name("main");
+}
+
+/**
+ * Name the calling thread in the exported trace, a no-op when tracing is off
+ */
+void trace_thread_name(const char* name) {
+    if (!trace_enabled) return;
+    get_thread_ring()->thread_name = name;
+}
+
+void trace_record(const char* name, uint64_t start, uint64_t end) {
+    trace_ring_s* ring = get_thread_ring();
+    trace_event_s* event = &ring->events[ring->written % TRACE_RING_EVENTS];
+    event->name = name;
+    event->start = start;
+    event->duration = end - start;
+    ring->written++;
+}
+
+//number of events still held by a ring, and the index of the oldest
+static unsigned long ring_count(trace_ring_s* ring) {
+    return ring->written < TRACE_RING_EVENTS ? ring->written : TRACE_RING_EVENTS;
+}
+
+static unsigned long ring_first(trace_ring_s* ring) {
+    return ring->written < TRACE_RING_EVENTS ? 0 : ring->written % TRACE_RING_EVENTS;
+}
+
+/**
+ * Write every recorded event as a Chrome trace, load it in chrome://tracing
+ * or ui.perfetto.dev
+ *
+ * @param filename Where to write the JSON
+ */
+void trace_write_chrome(char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not create trace file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int first = 1;
+    for (trace_ring_s* ring = rings; ring != NULL; ring = ring->next) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", ring->tid, ring->thread_name);
+        first = 0;
+
+        unsigned long count = ring_count(ring);
+        unsigned long start = ring_first(ring);
+        for (unsigned long i = 0; i < count; i++) {
+            trace_event_s* event = &ring->events[(start + i) % TRACE_RING_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, ring->tid, (event->start - trace_epoch) / 1e3, event->duration / 1e3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+static int compare_totals(const void* a, const void* b) {
+    const trace_totals_s* x = (const trace_totals_s*)a;
+    const trace_totals_s* y = (const trace_totals_s*)b;
+    if (x->total == y->total) return 0;
+    return x->total < y->total ? 1 : -1;
+}
+
+/**
+ * Print count, total, mean, min and max time per scope name across all
+ * threads, largest total first
+ */
+void trace_print_summary() {
+    int capacity = 16;
+    int n_totals = 0;
+    trace_totals_s* totals = (trace_totals_s*)malloc(capacity * sizeof(trace_totals_s));
+    if (totals == NULL) {
+        fprintf(stderr, "Memory allocation failed for trace summary\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long dropped = 0;
+    for (trace_ring_s* ring = rings; ring != NULL; ring = ring->next) {
+        unsigned long count = ring_count(ring);
+        unsigned long start = ring_first(ring);
+        dropped += ring->written - count;
+
+        for (unsigned long i = 0; i < count; i++) {
+            trace_event_s* event = &ring->events[(start + i) % TRACE_RING_EVENTS];
+
+            int t = 0;
+            while (t < n_totals && strcmp(totals[t].name, event->name) != 0) t++;
+            if (t == n_totals) {
+                if (n_totals == capacity) {
+                    capacity *= 2;
+                    totals = (trace_totals_s*)realloc(totals, capacity * sizeof(trace_totals_s));
+                    if (totals == NULL) {
+                        fprintf(stderr, "Memory allocation failed for trace summary\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                totals[t].name = event->name;
+                totals[t].count = 0;
+                totals[t].total = 0;
+                totals[t].min = event->duration;
+                totals[t].max = event->duration;
+                n_totals++;
+            }
+
+            totals[t].count++;
+            totals[t].total += event->duration;
+            if (event->duration < totals[t].min) totals[t].min = event->duration;
+            if (event->duration > totals[t].max) totals[t].max = event->duration;
+        }
+    }
+
+    qsort(totals, n_totals, sizeof(trace_totals_s), compare_totals);
+
+    uint64_t end = trace_end_time != 0 ? trace_end_time : trace_now();
+    double wall = (end - trace_epoch) / 1e6;
+
+    printf("\n**************************************** Trace ****************************************\n");
+    printf("%-24s %8s %12s %7s %12s %12s %12s\n", "scope", "count", "total ms", "% wall", "mean us", "min us", "max us");
+    for (int t = 0; t < n_totals; t++) {
+        printf("%-24s %8ld %12.3f %6.1f%% %12.3f %12.3f %12.3f\n", totals[t].name, totals[t].count,
+               totals[t].total / 1e6, wall > 0 ? 100.0 * (totals[t].total / 1e6) / wall : 0.0,
+               totals[t].total / 1e3 / totals[t].count, totals[t].min / 1e3, totals[t].max / 1e3);
+    }
+    printf("Traced wall time: %.3f ms, threads: %d", wall, n_rings);
+    if (dropped > 0) printf(", %lu oldest events overwritten", dropped);
+    printf("\n***************************************************************************************\n");
+
+    free(totals);
+}
+
+/**
+ * Stop recording. The rings are kept for the exporters until trace_free()
+ */
+void trace_stop() {
+    trace_end_time = trace_now();
+    trace_enabled = 0;
+}
+
+void trace_free() {
+    while (rings != NULL) {
+        trace_ring_s* next = rings->next;
+        free(rings->events);
+        free(rings);
+        rings = next;
+    }
+    n_rings = 0;
+    thread_ring = NULL;
+}
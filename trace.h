@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+//events kept per thread, older ones are overwritten once the ring is full
+#define TRACE_RING_EVENTS 65536
+
+/**
+ * One completed scope, timestamps are CLOCK_MONOTONIC nanoseconds
+ * name must be a string literal or otherwise outlive the trace
+ */
+typedef struct {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+} trace_event_s;
+
+//handle returned by trace_begin(), start is 0 when tracing is off
+typedef struct {
+    const char* name;
+    uint64_t start;
+} trace_scope_s;
+
+extern int trace_enabled;
+
+void trace_start();
+void trace_thread_name(const char* name);
+uint64_t trace_now();
+double now_seconds();
+void trace_record(const char* name, uint64_t start, uint64_t end);
+void trace_write_chrome(char* filename);
+void trace_print_summary();
+void trace_stop();
+void trace_free();
+
+//when tracing is off a scope costs one predictable branch at each end
+static inline trace_scope_s trace_begin(const char* name) {
+    trace_scope_s scope = {name, 0};
+    if (__builtin_expect(trace_enabled, 0)) scope.start = trace_now();
+    return scope;
+}
+
+static inline void trace_end(trace_scope_s* scope) {
+    if (__builtin_expect(scope->start != 0, 0)) trace_record(scope->name, scope->start, trace_now());
+}
+
+/**
+ * Time the rest of the enclosing block, the event is recorded when the block
+ * is left by any path
+ */
+#define TRACE_SCOPE(name) TRACE_SCOPE_AT(name, __LINE__)
+#define TRACE_SCOPE_AT(name, line) TRACE_SCOPE_VAR(name, line)
+#define TRACE_SCOPE_VAR(name, line) \
+    trace_scope_s trace_scope_##line __attribute__((cleanup(trace_end), unused)) = trace_begin(name)
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "winograd.h"
+
+/**
+ * Transform matrices for Winograd minimal filtering (Lavin & Gray)
+ *
+ * F(m, 3) computes m outputs of a 3 tap correlation from m + 2 inputs
+ * The 2D engine nests the 1D algorithm with itself: Y = A^T [U . V] A
+ * where U = G g G^T is the kernel and V = B^T d B is the input tile
+ *
+ * The constants in B^T and A^T are 0, +-1, +-2, +-4, +-5 and +-8 which are
+ * shift-and-add in hardware, so only the elementwise products go through
+ * multiplier() and show up in the multiply count
+ */
+static const fcu_data_t BT_F2[4][4] = {
+    { 1,  0, -1,  0 },
+    { 0,  1,  1,  0 },
+    { 0, -1,  1,  0 },
+    { 0,  1,  0, -1 }
+};
+
+static const fcu_data_t G_F2[4][3] = {
+    { 1.0,  0.0, 0.0 },
+    { 0.5,  0.5, 0.5 },
+    { 0.5, -0.5, 0.5 },
+    { 0.0,  0.0, 1.0 }
+};
+
+static const fcu_data_t AT_F2[2][4] = {
+    { 1, 1,  1,  0 },
+    { 0, 1, -1, -1 }
+};
+
+static const fcu_data_t BT_F4[6][6] = {
+    { 4,  0, -5,  0, 1, 0 },
+    { 0, -4, -4,  1, 1, 0 },
+    { 0,  4, -4, -1, 1, 0 },
+    { 0, -2, -1,  2, 1, 0 },
+    { 0,  2, -1, -2, 1, 0 },
+    { 0,  4,  0, -5, 0, 1 }
+};
+
+static const fcu_data_t G_F4[6][3] = {
+    {  1.0 / 4.0,   0.0,         0.0       },
+    { -1.0 / 6.0,  -1.0 / 6.0,  -1.0 / 6.0 },
+    { -1.0 / 6.0,   1.0 / 6.0,  -1.0 / 6.0 },
+    {  1.0 / 24.0,  1.0 / 12.0,  1.0 / 6.0 },
+    {  1.0 / 24.0, -1.0 / 12.0,  1.0 / 6.0 },
+    {  0.0,         0.0,         1.0       }
+};
+
+static const fcu_data_t AT_F4[4][6] = {
+    { 1, 1,  1, 1,  1, 0 },
+    { 0, 1, -1, 2, -2, 0 },
+    { 0, 1,  1, 4,  4, 0 },
+    { 0, 1, -1, 8, -8, 1 }
+};
+
+//pick the matrices for a tile size, returned as flat row-major arrays
+static void winograd_matrices(int m, const fcu_data_t** bt, const fcu_data_t** g, const fcu_data_t** at) {
+    if (m == 2) {
+        *bt = &BT_F2[0][0];
+        *g = &G_F2[0][0];
+        *at = &AT_F2[0][0];
+    } else {
+        *bt = &BT_F4[0][0];
+        *g = &G_F4[0][0];
+        *at = &AT_F4[0][0];
+    }
+}
+
+/**
+ * Precompute the transformed kernel U = G g G^T
+ *
+ * The FCU convolves each kernel row with the image row, so h_0 multiplies the
+ * newest pixel (x_2 of the window). Winograd computes a correlation, so the
+ * rows are reversed here to give the same output as the FCU datapath
+ *
+ * @param wk Pointer to fill in, allocated here like the other init functions
+ * @param kernel The 3x3 kernel already loaded for the FCUs
+ * @param m Output tile edge, 2 for F(2x2, 3x3) or 4 for F(4x4, 3x3)
+ */
+winograd_kernel_s* init_winograd_kernel(winograd_kernel_s* wk, kernel_s* kernel, int m) {
+    if (m != 2 && m != 4) {
+        fprintf(stderr, "Winograd tile size must be 2 or 4\n");
+        exit(EXIT_FAILURE);
+    }
+
+    wk = (winograd_kernel_s*)malloc(sizeof(winograd_kernel_s));
+    if (wk == NULL) {
+        fprintf(stderr, "Memory allocation failed for Winograd kernel\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(wk, 0, sizeof(winograd_kernel_s));
+
+    wk->m = m;
+    wk->alpha = m + KERNEL_SIZE - 1;
+
+    fcu_coefficients_s* rows[3] = { kernel->kernel_row_1, kernel->kernel_row_2, kernel->kernel_row_3 };
+    fcu_data_t g[3][3];
+    for (int r = 0; r < 3; r++) {
+        g[r][0] = rows[r]->h_2;
+        g[r][1] = rows[r]->h_1;
+        g[r][2] = rows[r]->h_0;
+    }
+
+    const fcu_data_t* bt;
+    const fcu_data_t* gm;
+    const fcu_data_t* at;
+    winograd_matrices(m, &bt, &gm, &at);
+
+    //tmp = G g  (alpha x 3)
+    fcu_data_t tmp[WINOGRAD_MAX_TILE][3];
+    for (int i = 0; i < wk->alpha; i++) {
+        for (int j = 0; j < 3; j++) {
+            tmp[i][j] = 0.0;
+            for (int k = 0; k < 3; k++) {
+                tmp[i][j] += gm[i * 3 + k] * g[k][j];
+            }
+        }
+    }
+
+    //U = tmp G^T  (alpha x alpha)
+    for (int i = 0; i < wk->alpha; i++) {
+        for (int j = 0; j < wk->alpha; j++) {
+            for (int k = 0; k < 3; k++) {
+                wk->u[i][j] += tmp[i][k] * gm[j * 3 + k];
+            }
+        }
+    }
+
+    return wk;
+}
+
+/**
+ * Run the 2D Winograd engine over the whole image
+ *
+ * Produces the dense stride 1 output of size (size - 2) x (size - 2). Tiles that
+ * hang over the right or bottom edge read zeros and only store the outputs
+ * that fall inside the feature map
+ *
+ * @param wk Transformed kernel from init_winograd_kernel()
+ * @param pixels Image pixels, size x size row-major
+ * @param size Width of the image
+ * @param output Feature map to write, output_size x output_size row-major
+ * @param output_size Width of the feature map
+ */
+void winograd_conv2d(winograd_kernel_s* wk, fcu_storage_t* pixels, int size, fcu_storage_t* output, int output_size) {
+    int m = wk->m;
+    int alpha = wk->alpha;
+
+    const fcu_data_t* bt;
+    const fcu_data_t* gm;
+    const fcu_data_t* at;
+    winograd_matrices(m, &bt, &gm, &at);
+
+    fcu_data_t d[WINOGRAD_MAX_TILE][WINOGRAD_MAX_TILE];
+    fcu_data_t tmp[WINOGRAD_MAX_TILE][WINOGRAD_MAX_TILE];
+    fcu_data_t v[WINOGRAD_MAX_TILE][WINOGRAD_MAX_TILE];
+
+    for (int ty = 0; ty < output_size; ty += m) {
+        for (int tx = 0; tx < output_size; tx += m) {
+
+            //gather the input tile
+            for (int i = 0; i < alpha; i++) {
+                for (int j = 0; j < alpha; j++) {
+                    int row = ty + i;
+                    int col = tx + j;
+                    d[i][j] = (row < size && col < size) ? storage_to_data(pixels[row * size + col]) : 0.0;
+                }
+            }
+
+            //input transform V = B^T d B
+            for (int i = 0; i < alpha; i++) {
+                for (int j = 0; j < alpha; j++) {
+                    tmp[i][j] = 0.0;
+                    for (int k = 0; k < alpha; k++) {
+                        tmp[i][j] += bt[i * alpha + k] * d[k][j];
+                    }
+                }
+            }
+            for (int i = 0; i < alpha; i++) {
+                for (int j = 0; j < alpha; j++) {
+                    v[i][j] = 0.0;
+                    for (int k = 0; k < alpha; k++) {
+                        v[i][j] += tmp[i][k] * bt[j * alpha + k];
+                    }
+                }
+            }
+
+            //elementwise product, the only real multiplies of the tile
+            for (int i = 0; i < alpha; i++) {
+                for (int j = 0; j < alpha; j++) {
+                    v[i][j] = multiplier(v[i][j], wk->u[i][j]);
+                }
+            }
+
+            //output transform Y = A^T M A
+            for (int i = 0; i < m; i++) {
+                for (int j = 0; j < alpha; j++) {
+                    tmp[i][j] = 0.0;
+                    for (int k = 0; k < alpha; k++) {
+                        tmp[i][j] += at[i * alpha + k] * v[k][j];
+                    }
+                }
+            }
+            for (int i = 0; i < m && ty + i < output_size; i++) {
+                for (int j = 0; j < m && tx + j < output_size; j++) {
+                    fcu_data_t y = 0.0;
+                    for (int k = 0; k < alpha; k++) {
+                        y += tmp[i][k] * at[j * alpha + k];
+                    }
+                    output[(ty + i) * output_size + tx + j] = data_to_storage(y);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "fcu.h"
+
+//largest input tile supported, F(4x4, 3x3) works on 6x6 tiles
+#define WINOGRAD_MAX_TILE 6
+
+/**
+ * Kernel for the 2D Winograd engine
+ *
+ * The 3x3 kernel is transformed once at kernel-load time (U = G g G^T) so the
+ * only work left per tile is the input transform, an elementwise product and
+ * the output transform
+ */
+typedef struct {
+    int m;      //outputs per tile edge (2 or 4)
+    int alpha;  //input tile edge, m + KERNEL_SIZE - 1
+    fcu_data_t u[WINOGRAD_MAX_TILE][WINOGRAD_MAX_TILE];
+} winograd_kernel_s;
+
+winograd_kernel_s* init_winograd_kernel(winograd_kernel_s* wk, kernel_s* kernel, int m);
+void winograd_conv2d(winograd_kernel_s* wk, fcu_storage_t* pixels, int size, fcu_storage_t* output, int output_size);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "workload.h"
+#include "trace.h"
+
+//rows per thread below which splitting the image costs more than it saves
+#define WORKLOAD_MIN_ROWS 64
+
+typedef struct {
+    const workload_s* workload;
+    const tensor_layout_s* layout;
+    fcu_storage_t* values;
+    int channel;
+    int size;
+    int first_row;
+    int last_row;
+} workload_job_s;
+
+static const char* WORKLOAD_NAMES[] = { "none", "random", "blobs", "gradient", "sparse" };
+
+//splitmix64 finaliser, a full avalanche of one 64-bit word
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+//key of one image, every hash of the image starts from it
+static uint64_t stream_key(const workload_s* workload) {
+    return mix64(workload->seed + 0x9e3779b97f4a7c15ULL * (uint64_t)(workload->stream + 1));
+}
+
+//independent 64-bit value for each (key, a, b), mix64(key ^ a) can be kept for a whole row
+static uint64_t workload_hash(uint64_t key, uint64_t a, uint64_t b) {
+    return mix64(mix64(key ^ a) + b);
+}
+
+//largest r with r * r <= n
+static long isqrt(long n) {
+    long r = 0;
+    for (long bit = 1L << 30; bit > 0; bit >>= 1) {
+        if ((r + bit) * (r + bit) <= n) r += bit;
+    }
+    return r;
+}
+
+int parse_workload_kind(const char* name, workload_kind_e* kind) {
+    for (int k = WORKLOAD_RANDOM; k <= WORKLOAD_SPARSE; k++) {
+        if (strcmp(name, WORKLOAD_NAMES[k]) == 0) {
+            *kind = (workload_kind_e)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void blobs_row(uint64_t key, int size, int r, fcu_storage_t* row, int block) {
+    for (int b = 0; b < WORKLOAD_BLOB_COUNT; b++) {
+        uint64_t h = workload_hash(key, 0xb10b, b);
+        long radius = size / 16 + (long)(h % (size / 4 + 1));
+        long cy = (long)((h >> 16) % size);
+        long cx = (long)((h >> 40) % size);
+        long dy = r - cy;
+        if (dy < -radius || dy > radius) continue;
+
+        //odd blobs are squares, even ones circles
+        long half = (b % 2) ? radius : isqrt(radius * radius - dy * dy);
+        long c0 = cx - half < 0 ? 0 : cx - half;
+        long c1 = cx + half >= size ? size - 1 : cx + half;
+        for (long c = c0; c <= c1; c++) row[c * block] = data_to_storage(255.0);
+    }
+}
+
+static void gradient_row(uint64_t key, int size, int r, fcu_storage_t* row, int block) {
+    uint64_t h = workload_hash(key, 0x6ad, 0);
+    long dx = (long)(h % 2049) - 1024;
+    long dy = (long)((h >> 32) % 2049) - 1024;
+    if (dx == 0 && dy == 0) dx = 1;
+
+    //the ramp runs from the lowest corner to the highest
+    long span = (labs(dx) + labs(dy)) * (size - 1);
+    long low = (dx < 0 ? dx : 0) * (long)(size - 1) + (dy < 0 ? dy : 0) * (long)(size - 1);
+    for (int c = 0; c < size; c++) {
+        long v = dx * c + dy * r - low;
+        row[c * block] = data_to_storage(span > 0 ? (double)(v * 255 / span) : 0.0);
+    }
+}
+
+static void sparse_row(const workload_s* workload, uint64_t key, int size, int r, fcu_storage_t* row, int block) {
+    uint64_t threshold = (uint64_t)(workload->density * 18446744073709551615.0);
+    if (workload->density >= 1.0) threshold = UINT64_MAX;
+
+    uint64_t row_key = mix64(key ^ (uint64_t)r);
+
+    for (int c0 = 0; c0 < size; c0 += WORKLOAD_SPARSE_TILE) {
+        uint64_t tile = workload_hash(key, 0x5ba25e00 + r / WORKLOAD_SPARSE_TILE, c0 / WORKLOAD_SPARSE_TILE);
+        if (workload->density <= 0.0 || tile > threshold) continue;
+        int c1 = c0 + WORKLOAD_SPARSE_TILE < size ? c0 + WORKLOAD_SPARSE_TILE : size;
+        for (int c = c0; c < c1; c++) {
+            //1 to 255, an on tile has no zero pixels
+            row[c * block] = data_to_storage((double)(1 + mix64(row_key + c) % 255));
+        }
+    }
+}
+
+static void* workload_worker(void* arg) {
+    workload_job_s* job = (workload_job_s*)arg;
+    const workload_s* workload = job->workload;
+    const tensor_layout_s* layout = job->layout;
+    uint64_t key = stream_key(workload);
+    TRACE_SCOPE("generate rows");
+
+    for (int r = job->first_row; r < job->last_row; r++) {
+        fcu_storage_t* row = layout_row(layout, job->values, job->channel, r);
+        //pixels past size are padding and stay zero
+        for (int c = 0; c < layout->cols; c++) row[c * layout->block] = data_to_storage(0.0);
+        if (r >= job->size) continue;
+
+        switch (workload->kind) {
+        case WORKLOAD_RANDOM: {
+            uint64_t row_key = mix64(key ^ (uint64_t)r);
+            for (int c = 0; c < job->size; c++) {
+                row[c * layout->block] = data_to_storage((double)(mix64(row_key + c) % 256));
+            }
+            break;
+        }
+        case WORKLOAD_BLOBS:
+            blobs_row(key, job->size, r, row, layout->block);
+            break;
+        case WORKLOAD_GRADIENT:
+            gradient_row(key, job->size, r, row, layout->block);
+            break;
+        case WORKLOAD_SPARSE:
+            sparse_row(workload, key, job->size, r, row, layout->block);
+            break;
+        default:
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fill one channel of a tensor with a synthetic image
+ *
+ * Rows are split into contiguous ranges, one per thread. No pixel depends on
+ * the split, so any thread count writes the same image
+ *
+ * @param workload What to generate
+ * @param layout Shape of the tensor, at least size x size
+ * @param values The tensor
+ * @param channel Channel to fill
+ * @param size Width and height of the image, the rest of the channel is zeroed
+ * @param n_threads Threads to generate with
+ */
+void generate_workload(const workload_s* workload, const tensor_layout_s* layout, fcu_storage_t* values, int channel,
+                       int size, int n_threads) {
+    int max_threads = (layout->rows + WORKLOAD_MIN_ROWS - 1) / WORKLOAD_MIN_ROWS;
+    if (n_threads > max_threads) n_threads = max_threads;
+    if (n_threads < 1) n_threads = 1;
+
+    workload_job_s* jobs = (workload_job_s*)malloc(n_threads * sizeof(workload_job_s));
+    pthread_t* threads = (pthread_t*)malloc(n_threads * sizeof(pthread_t));
+    if (jobs == NULL || threads == NULL) {
+        fprintf(stderr, "Memory allocation failed for workload threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < n_threads; t++) {
+        jobs[t].workload = workload;
+        jobs[t].layout = layout;
+        jobs[t].values = values;
+        jobs[t].channel = channel;
+        jobs[t].size = size;
+        jobs[t].first_row = (int)((long)layout->rows * t / n_threads);
+        jobs[t].last_row = (int)((long)layout->rows * (t + 1) / n_threads);
+    }
+
+    //the calling thread takes the first range
+    for (int t = 1; t < n_threads; t++) {
+        if (pthread_create(&threads[t], NULL, workload_worker, &jobs[t]) != 0) {
+            fprintf(stderr, "Could not start workload thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    workload_worker(&jobs[0]);
+    for (int t = 1; t < n_threads; t++) pthread_join(threads[t], NULL);
+
+    free(jobs);
+    free(threads);
+}
@@ -0,0 +1,48 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+
+#include "fcu.h"
+#include "layout.h"
+
+//side of the square tiles a sparse workload switches on and off
+#define WORKLOAD_SPARSE_TILE 16
+//filled circles and squares per channel of a blobs workload
+#define WORKLOAD_BLOB_COUNT 8
+
+/**
+ * Synthetic inputs, generated in memory instead of read from the inputs/ text shapes
+ *
+ * WORKLOAD_RANDOM   - every pixel uniform in [0, 255]
+ * WORKLOAD_BLOBS    - WORKLOAD_BLOB_COUNT filled circles and squares of 255 on 0
+ * WORKLOAD_GRADIENT - a linear ramp from 0 to 255 in a random direction
+ * WORKLOAD_SPARSE   - random pixels in WORKLOAD_SPARSE_TILE tiles that are
+ *                     on with probability density, zero elsewhere
+ */
+typedef enum {
+    WORKLOAD_NONE,
+    WORKLOAD_RANDOM,
+    WORKLOAD_BLOBS,
+    WORKLOAD_GRADIENT,
+    WORKLOAD_SPARSE
+} workload_kind_e;
+
+/**
+ * Every pixel is a function of (seed, stream, row, column) alone, so an image
+ * is the same for any thread count and two streams of one seed are
+ * independent images. Pixels are whole numbers in [0, 255] like the text
+ * shapes, exact in every storage type
+ */
+typedef struct {
+    workload_kind_e kind;
+    uint64_t seed;
+    int stream;         //image or channel number
+    double density;     //fraction of sparse tiles switched on
+} workload_s;
+
+int parse_workload_kind(const char* name, workload_kind_e* kind);
+void generate_workload(const workload_s* workload, const tensor_layout_s* layout, fcu_storage_t* values, int channel,
+                       int size, int n_threads);
+
+#endif